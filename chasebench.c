@@ -0,0 +1,134 @@
+/*
+ * chasebench.c - pointer-chasing benchmark for mm.c's heap
+ *
+ * Fills a working set of the given size with nodes from mm_malloc,
+ * links them into one cycle in random order, and times walking it.
+ * Nearly every hop lands on a different page, so once the working set
+ * outgrows what the TLB maps, the walk pays for a page-table walk on
+ * top of each cache miss.  Build it with and without huge pages to
+ * see how much of that they save:
+ *
+ *     gcc -O2 -o chasebench chasebench.c mm.c memlib.c
+ *     gcc -O2 -DMM_HUGEPAGES -o chasebench-thp chasebench.c mm.c memlib.c
+ *
+ * Transparent huge pages must be enabled ("always" or "madvise" in
+ * /sys/kernel/mm/transparent_hugepage/enabled).  Each run reports how
+ * much of the process was in huge pages, as /proc/self/smaps_rollup
+ * tells it.
+ *
+ * Usage: chasebench [max MB [hops]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+#define NODE_SIZE 128	/* bytes per node; past the slab sizes */
+#define MIN_MB 4	/* smallest working set tried */
+
+struct node {
+    struct node *next;
+    long pad[NODE_SIZE / sizeof(long) - 1];
+};
+
+static long hops = 20000000;
+
+/*
+ * xorshift - small random number generator
+ */
+static unsigned long xorshift(unsigned long *state)
+{
+    unsigned long x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/*
+ * huge_kb - kilobytes of the process backed by transparent huge pages
+ */
+static long huge_kb(void)
+{
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    char line[256];
+    long kb = -1;
+
+    if (f == NULL)
+	return -1;
+    while (fgets(line, sizeof(line), f) != NULL)
+	if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+	    break;
+    fclose(f);
+    return kb;
+}
+
+/*
+ * run - build a cycle of mb megabytes of nodes and return the time
+ *    per hop around it, in nanoseconds
+ */
+static double run(size_t mb, long *hugekb)
+{
+    size_t n = mb * 1024 * 1024 / NODE_SIZE;
+    struct node **order = malloc(n * sizeof(*order));
+    unsigned long seed = 88172645463325252UL;
+    struct node *p, *tmp;
+    struct timespec start, end;
+    size_t i, j;
+    long h;
+
+    mem_reset_brk();
+    if (order == NULL || mm_init() < 0) {
+	fprintf(stderr, "out of memory\n");
+	exit(1);
+    }
+    for (i = 0; i < n; i++) {
+	order[i] = mm_malloc(NODE_SIZE);
+	memset(order[i], 0, NODE_SIZE);
+    }
+    for (i = n - 1; i > 0; i--) {
+	j = xorshift(&seed) % (i + 1);
+	tmp = order[i];
+	order[i] = order[j];
+	order[j] = tmp;
+    }
+    for (i = 0; i < n; i++)
+	order[i]->next = order[(i + 1) % n];
+    *hugekb = huge_kb();
+
+    p = order[0];
+    for (h = 0; h < (long)n; h++)	/* warm up */
+	p = p->next;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (h = 0; h < hops; h++)
+	p = p->next;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (p == NULL)			/* keep the walk */
+	printf("?\n");
+
+    free(order);
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / hops;
+}
+
+int main(int argc, char **argv)
+{
+    size_t maxmb = argc > 1 ? (size_t)atol(argv[1]) : 1024;
+    size_t mb;
+    long hugekb;
+    double ns;
+
+    if (argc > 2)
+	hops = atol(argv[2]);
+    mem_init();
+
+    printf("%8s %10s %12s\n", "MB", "ns/hop", "huge KB");
+    for (mb = MIN_MB; mb <= maxmb; mb *= 4) {
+	ns = run(mb, &hugekb);
+	printf("%8zu %10.1f %12ld\n", mb, ns, hugekb);
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * memlib.c - a module that simulates the memory system
+ *
+ * mm.c gets its heap from mem_sbrk, as a program gets its heap from
+ * sbrk, but the heap lives in a region this module reserves with mmap,
+ * so that the allocator can be reset, measured, and used next to the
+ * system malloc in one process.  The region is only address space
+ * until the heap grows into it.  Unlike the textbook version, mem_sbrk
+ * also takes a negative increment, and the pages it gives back are
+ * released to the system.  Built with -DMM_HUGEPAGES, the region is
+ * aligned to a huge page and advised to be backed by huge pages.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "memlib.h"
+
+#define MAX_HEAP ((size_t)1 << 32)	/* address space reserved for the heap */
+#define HUGE_PAGE ((size_t)2 << 20)	/* transparent huge page size */
+
+static char *mem_start_brk;	/* first byte of the heap */
+static char *mem_brk;		/* last byte of the heap plus 1 */
+static char *mem_max_addr;	/* largest legal heap address plus 1 */
+
+/*
+ * mem_init - reserve the region the heap grows into
+ */
+void mem_init(void)
+{
+#ifdef MM_HUGEPAGES
+    char *map = mmap(NULL, MAX_HEAP + HUGE_PAGE, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (map == MAP_FAILED) {
+	fprintf(stderr, "mem_init: mmap failed\n");
+	exit(1);
+    }
+    /* Cut off what lies outside an aligned region. */
+    mem_start_brk = (char *)(((size_t)map + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+    if (mem_start_brk > map)
+	munmap(map, mem_start_brk - map);
+    munmap(mem_start_brk + MAX_HEAP, map + HUGE_PAGE - mem_start_brk);
+    madvise(mem_start_brk, MAX_HEAP, MADV_HUGEPAGE);
+#else
+    mem_start_brk = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	fprintf(stderr, "mem_init: mmap failed\n");
+	exit(1);
+    }
+#endif
+    mem_max_addr = mem_start_brk + MAX_HEAP;
+    mem_brk = mem_start_brk;
+}
+
+/*
+ * mem_deinit - give the region back to the system
+ */
+void mem_deinit(void)
+{
+    munmap(mem_start_brk, MAX_HEAP);
+}
+
+/*
+ * mem_release - let the system drop the whole pages in [lo, hi)
+ */
+static void mem_release(char *lo, char *hi)
+{
+    size_t pagesize = mem_pagesize();
+    char *start = (char *)(((size_t)lo + pagesize - 1) & ~(pagesize - 1));
+
+    if (hi > start)
+	madvise(start, hi - start, MADV_DONTNEED);
+}
+
+/*
+ * mem_reset_brk - empty the heap
+ */
+void mem_reset_brk(void)
+{
+    mem_release(mem_start_brk, mem_brk);
+    mem_brk = mem_start_brk;
+}
+
+/*
+ * mem_sbrk - grow the heap by incr bytes, or shrink it if incr is
+ *    negative, and return the old end of the heap, or (void *)-1
+ *    with errno set to ENOMEM if the heap cannot grow that far
+ */
+void *mem_sbrk(int incr)
+{
+    char *old_brk = mem_brk;
+
+    if ((incr < 0 && mem_brk + incr < mem_start_brk) ||
+	(incr > 0 && (size_t)incr > (size_t)(mem_max_addr - mem_brk))) {
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+    mem_brk += incr;
+    if (incr < 0)
+	mem_release(mem_brk, old_brk);
+    return (void *)old_brk;
+}
+
+/*
+ * mem_heap_lo - return the address of the first heap byte
+ */
+void *mem_heap_lo(void)
+{
+    return (void *)mem_start_brk;
+}
+
+/*
+ * mem_heap_hi - return the address of the last heap byte
+ */
+void *mem_heap_hi(void)
+{
+    return (void *)(mem_brk - 1);
+}
+
+/*
+ * mem_heapsize - return the heap size in bytes
+ */
+size_t mem_heapsize(void)
+{
+    return (size_t)(mem_brk - mem_start_brk);
+}
+
+/*
+ * mem_pagesize - return the page size of the system
+ */
+size_t mem_pagesize(void)
+{
+    return (size_t)getpagesize();
+}
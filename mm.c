@@ -15,10 +15,21 @@
  *   in memory.
  *-------------------------------------------------------------------- */
 
+#define _GNU_SOURCE /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <execinfo.h>
+
+#ifdef MM_THREADSAFE
+#include <pthread.h>
+#endif
 
 #include "memlib.h"
 #include "mm.h"
@@ -79,15 +90,107 @@ struct BlockInfo {
 typedef struct BlockInfo BlockInfo;
 
 
-/* Pointer to the first BlockInfo in the free list, the list's head. 
-   
-   A pointer to the head of the free list in this implementation is
-   always stored in the first word in the heap.  mem_heap_lo() returns
-   a pointer to the first word in the heap, so we cast the result of
-   mem_heap_lo() to a BlockInfo** (a pointer to a pointer to
-   BlockInfo) and dereference this to get a pointer to the first
-   BlockInfo in the free list. */
-#define FREE_LIST_HEAD *((BlockInfo **)mem_heap_lo())
+/* Free blocks are kept in segregated free lists, indexed by two
+   levels of size class.  The first level is floor(log2(size)); the
+   second level splits each power-of-two range into SL_COUNT equal
+   parts.  One bitmap says which first-level classes have a non-empty
+   list and one bitmap per first-level class says which of its lists
+   are non-empty, so the first non-empty list at or above a size class
+   is found with two find-first-set operations.
+
+   By default there is a single list per power of two and mm_malloc
+   searches the request's own list first-fit, which packs the heap
+   well.  Built with -DMM_TLSF the allocator is a Two-Level Segregated
+   Fit allocator instead: 16 lists per power of two, and requests are
+   rounded up to the next list boundary, so that the head of the list
+   found always fits.  mm_malloc and mm_free then take bounded time no
+   matter how fragmented the heap is. */
+#ifdef MM_TLSF
+#define SL_SHIFT 4
+#else
+#define SL_SHIFT 0
+#endif
+#define SL_COUNT (1 << SL_SHIFT)
+
+/* Number of first-level classes.  The last one also takes every
+   block too large for it. */
+#define FL_COUNT 40
+
+#define NUM_SIZE_CLASSES (FL_COUNT * SL_COUNT)
+
+/* Built with -DMM_QUICKLISTS, freed blocks of up to QUICK_MAX_SIZE
+   bytes are not merged with their neighbours at once, but kept on a
+   quick list of their size, still marked used, and given straight
+   back to the next request of that size.  (Blocks at the end of the
+   heap are merged at once, so that it can still shrink.)  A program
+   that frees and allocates blocks of the same sizes by turns then no
+   longer merges and splits the same memory over and over.  The quick lists are
+   emptied into the free lists, merging as usual, when a request finds
+   no free block, when they hold more than QUICK_MAX_BYTES, when a
+   block of that size or more is freed, and before the heap is trimmed
+   or measured. */
+#ifdef MM_QUICKLISTS
+#define QUICK_MAX_SIZE 512
+#define QUICK_MAX_BYTES (64 * 1024)
+// Enough for any ALIGNMENT; see QUICK_BIN.
+#define QUICK_BINS (QUICK_MAX_SIZE / 8)
+#endif
+
+/* The heap prologue sits at the start of the heap, before the first
+   block, and holds the heads of the free lists.  heapLo points at the
+   first word in the heap being worked on, so we cast it to a
+   HeapPrologue* to get at them. */
+struct HeapPrologue {
+  // Head of the free list of each size class.
+  struct BlockInfo* freeListHeads[NUM_SIZE_CLASSES];
+  // Bit fl is set if first-level class fl has a non-empty list.
+  uint64_t flBitmap;
+  // Bit sl of slBitmap[fl] is set if list (fl, sl) is non-empty.
+  uint32_t slBitmap[FL_COUNT];
+  // Bytes the heap grows by next time, unless more is needed.
+  size_t growChunk;
+  // Number of times the heap has grown, and the bytes it grew by
+  // beyond what the requests needed.
+  size_t numExtensions;
+  size_t bytesOverReserved;
+  // Bytes in free blocks, and the number of free blocks in each
+  // first-level class.
+  size_t freeBytes;
+  size_t freeBlockCounts[FL_COUNT];
+  // Calls to mm_malloc and mm_free (in the default build), and merges
+  // of free blocks.
+  size_t numMallocs;
+  size_t numFrees;
+  size_t numCoalesces;
+  // Heap memory from here up has held nothing but the headers, links
+  // and boundary tags of free blocks since mem_sbrk handed it out
+  // zeroed (see mm_calloc).
+  char* freshFrom;
+#ifdef MM_QUICKLISTS
+  // Freed blocks not yet merged, by size, and their total size.
+  struct BlockInfo* quickLists[QUICK_BINS];
+  size_t quickBytes;
+#endif
+};
+typedef struct HeapPrologue HeapPrologue;
+
+/* A heap made by mm_heap_create (see HEAPS below) lives in a region
+   of its own rather than the one memlib provides. */
+struct mm_heap {
+  char* lo;     // first byte of the heap, where its prologue is
+  char* brk;    // last byte of the heap plus 1
+  char* max;    // end of the region reserved for it
+};
+
+// The heap being worked on: NULL for the memlib heap set up by
+// mm_init.  heapLo is its first byte.
+static struct mm_heap* heap;
+static char* heapLo;
+
+#define PROLOGUE ((HeapPrologue *)heapLo)
+
+/* Pointer to the first BlockInfo in the free list of size class c. */
+#define FREE_LIST_HEAD(c) (PROLOGUE->freeListHeads[c])
 
 /* Size of a word on this architecture. */
 #define WORD_SIZE sizeof(void*)
@@ -96,8 +199,35 @@ typedef struct BlockInfo BlockInfo;
    and boundary tag) */
 #define MIN_BLOCK_SIZE (sizeof(BlockInfo) + WORD_SIZE)
 
-/* Alignment of blocks returned by mm_malloc. */
+/* log2(MIN_BLOCK_SIZE) */
+#define MIN_BLOCK_SHIFT 5
+
+/* Alignment of blocks returned by mm_malloc: 8 unless built with
+   -DMM_ALIGNMENT=n for a power of two n (16 to match the C library on
+   x86-64). */
+#ifdef MM_ALIGNMENT
+#if MM_ALIGNMENT != 8 && MM_ALIGNMENT != 16
+#error "MM_ALIGNMENT must be 8 or 16"
+#endif
+#define ALIGNMENT MM_ALIGNMENT
+#else
 #define ALIGNMENT 8
+#endif
+
+/* Bytes taken by the prologue, padded so that the payload of every
+   block (one word past its header) is aligned. */
+#define PROLOGUE_SIZE \
+  (((sizeof(HeapPrologue) + WORD_SIZE + ALIGNMENT - 1) & ~(ALIGNMENT - 1)) - WORD_SIZE)
+
+/* The first block in the heap follows the prologue. */
+#define FIRST_BLOCK ((BlockInfo *)UNSCALED_POINTER_ADD(heapLo, PROLOGUE_SIZE))
+
+#ifdef MM_QUICKLISTS
+/* Quick list of a block of the given size; lists are ALIGNMENT apart. */
+#define QUICK_BIN(size) (((size) - MIN_BLOCK_SIZE) / ALIGNMENT)
+
+static void flushQuickLists(void);
+#endif
 
 /* SIZE(blockInfo->sizeAndTags) extracts the size of a 'sizeAndTags' field.
    Also, calling SIZE(size) selects just the higher bits of 'size' to ensure
@@ -111,11 +241,12 @@ typedef struct BlockInfo BlockInfo;
         ^                                       ^
       high bit                               low bit
 
-   Since ALIGNMENT == 8, we reserve the low 3 bits of sizeAndTags for tag
+   Since ALIGNMENT >= 8, we reserve the low 3 bits of sizeAndTags for tag
    bits, and we use bits 3-63 to store the size.
 
    Bit 0 (2^0 == 1): TAG_USED
    Bit 1 (2^1 == 2): TAG_PRECEDING_USED
+   Bit 2 (2^2 == 4): TAG_MMAPPED
 */
 #define SIZE(x) ((x) & ~(ALIGNMENT - 1))
 
@@ -128,40 +259,196 @@ typedef struct BlockInfo BlockInfo;
    of the previous block from its boundary tag */
 #define TAG_PRECEDING_USED 2
 
+/* TAG_MMAPPED marks a used block that is not in the heap but has an
+   anonymous mapping of its own (see mapBlock). */
+#define TAG_MMAPPED 4
+
+/* Does blockInfo have a mapping of its own?  In the thread-safe build
+   the header of a used heap block may be changing under us, but never
+   this bit. */
+#define IS_MAPPED(blockInfo) \
+  (__atomic_load_n(&(blockInfo)->sizeAndTags, __ATOMIC_RELAXED) & TAG_MMAPPED)
+
+
+/* Built with -DMM_THREADSAFE the allocator may be called from any
+   number of threads.  The heap is shared and protected by heapLock,
+   and each thread keeps a cache of small used blocks with one bin per
+   block size, so that most calls to mm_malloc and mm_free never take
+   the lock: a bin is refilled from the heap, and flushed back to it,
+   many blocks at a time.
+
+   Every used block records in its last word (where a free block keeps
+   its boundary tag) the cache of the thread that allocated it, so a
+   block freed by some other thread goes back to its owner.  Those
+   frees are pushed onto the owner's remoteFrees list with a
+   compare-and-swap.  Only the owner takes blocks off the list, and it
+   takes them all at once, so the list needs neither a lock nor ABA
+   protection.  When the owner exits it closes the list, and a free
+   that finds it closed goes straight back to the heap. */
+#ifdef MM_THREADSAFE
+#define OWNER_SIZE WORD_SIZE
+#else
+#define OWNER_SIZE 0
+#endif
+
+#ifdef MM_THREADSAFE
+/* Largest block size kept in a thread cache. */
+#define CACHE_MAX_SIZE 512
+
+/* Cache bin of a block of the given size; bins are ALIGNMENT apart. */
+#define CACHE_BIN(size) (((size) - MIN_BLOCK_SIZE) / ALIGNMENT)
+#define CACHE_BINS ((int)CACHE_BIN(CACHE_MAX_SIZE) + 1)
+
+/* Blocks taken from the heap on a miss, and the most a bin may hold
+   before half of it is given back. */
+#define CACHE_BATCH 16
+#define CACHE_BIN_MAX 64
+
+/* Threads beyond this many share the heap without a cache. */
+#define MAX_THREADS 64
+
+/* The remoteFrees list of a cache whose thread has exited. */
+#define REMOTE_CLOSED ((struct BlockInfo*)1)
+
+struct ThreadCache {
+  // Cached used blocks of each size, linked through next.
+  struct BlockInfo* bins[CACHE_BINS];
+  int binCounts[CACHE_BINS];
+  // Blocks owned here but freed by other threads.
+  struct BlockInfo* remoteFrees;
+  // Set while a live thread owns this cache.
+  int inUse;
+  // Calls to mm_malloc and mm_free from the thread.
+  size_t numMallocs;
+  size_t numFrees;
+};
+typedef struct ThreadCache ThreadCache;
+
+static pthread_mutex_t heapLock = PTHREAD_MUTEX_INITIALIZER;
+// Guards the profile; taken before heapLock (see PROFILING).
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadCache threadCaches[MAX_THREADS];
+// Bumped by mm_init, which throws away every cache.
+static unsigned cacheGeneration;
+static __thread ThreadCache* myCache;
+static __thread unsigned myGeneration;
+// Calls from threads without a cache.
+static size_t uncachedMallocs;
+static size_t uncachedFrees;
+static pthread_key_t cacheKey;
+static pthread_once_t cacheKeyOnce = PTHREAD_ONCE_INIT;
+static void makeCacheKey(void);
+
+/* The cache that owns a used block of blockSize bytes. */
+#define OWNER(block, blockSize) \
+  (*(ThreadCache**)UNSCALED_POINTER_ADD(block, (blockSize) - WORD_SIZE))
+#endif
+
+/* Size of a used block, read without the lock.  Other threads may set
+   or clear TAG_PRECEDING_USED in its header while we read it, but the
+   size bits only change under its own thread. */
+#define USED_SIZE(block) SIZE(__atomic_load_n(&(block)->sizeAndTags, __ATOMIC_RELAXED))
+
+
+/* floor(log2(x)) for x > 0 */
+#define FLOOR_LOG2(x) ((int)(sizeof(size_t) * 8 - 1) - __builtin_clzl(x))
+
+/* Return the size class, fl * SL_COUNT + sl, of a block of blockSize
+   bytes. */
+static int sizeClass(size_t blockSize) {
+  int log2Size = FLOOR_LOG2(blockSize);
+  int fl = log2Size - MIN_BLOCK_SHIFT;
+  int sl;
+
+  if (fl >= FL_COUNT) {
+    return NUM_SIZE_CLASSES - 1;
+  }
+  // The SL_SHIFT bits below the leading one pick the second level.
+  sl = (int)(blockSize >> (log2Size - SL_SHIFT)) & (SL_COUNT - 1);
+  return (fl << SL_SHIFT) | sl;
+}
+
+/* Return the first size class at or above c with a non-empty free
+   list, or -1 if there is none. */
+static int findNonEmptyClass(int c) {
+  int fl = c >> SL_SHIFT;
+  uint32_t slMap = PROLOGUE->slBitmap[fl] & (~(uint32_t)0 << (c & (SL_COUNT - 1)));
+  uint64_t flMap;
+
+  if (slMap == 0) {
+    // Nothing left in this first-level class: take the next one up.
+    flMap = (fl + 1 < FL_COUNT) ? PROLOGUE->flBitmap & (~(uint64_t)0 << (fl + 1)) : 0;
+    if (flMap == 0) {
+      return -1;
+    }
+    fl = __builtin_ctzll(flMap);
+    slMap = PROLOGUE->slBitmap[fl];
+  }
+  return (fl << SL_SHIFT) | __builtin_ctz(slMap);
+}
 
-/* Find a free block of the requested size in the free list.  Returns
+/* Find a free block of the requested size in the free lists.  Returns
    NULL if no free block is large enough. */
 static void * searchFreeList(size_t reqSize) {   
   BlockInfo* freeBlock;
+  int c;
 
-  freeBlock = FREE_LIST_HEAD;
-  while (freeBlock != NULL){
+#ifdef MM_TLSF
+  // Round the request up to the next list boundary: every block on
+  // that list, and on any list above it, is large enough.
+  size_t roundedSize = reqSize;
+
+  if (FLOOR_LOG2(reqSize) - MIN_BLOCK_SHIFT < FL_COUNT - 1) {
+    roundedSize += ((size_t)1 << (FLOOR_LOG2(reqSize) - SL_SHIFT)) - 1;
+  }
+  c = findNonEmptyClass(sizeClass(roundedSize));
+#else
+  // The request's own list can hold smaller blocks too, so search it
+  // first-fit before moving up.
+  c = sizeClass(reqSize);
+  for (freeBlock = FREE_LIST_HEAD(c); freeBlock != NULL; freeBlock = freeBlock->next) {
     if (SIZE(freeBlock->sizeAndTags) >= reqSize) {
       return freeBlock;
-    } else {
-      freeBlock = freeBlock->next;
     }
   }
-  return NULL;
+  c = (c + 1 < NUM_SIZE_CLASSES) ? findNonEmptyClass(c + 1) : -1;
+#endif
+  if (c < 0) {
+    return NULL;
+  }
+
+  freeBlock = FREE_LIST_HEAD(c);
+  // Only the catch-all last list may hold blocks that are too small.
+  while (freeBlock != NULL && SIZE(freeBlock->sizeAndTags) < reqSize) {
+    freeBlock = freeBlock->next;
+  }
+  return freeBlock;
 }
            
-/* Insert freeBlock at the head of the list.  (LIFO) */
+/* Insert freeBlock at the head of the list of its size class.  (LIFO) */
 static void insertFreeBlock(BlockInfo* freeBlock) {
-  BlockInfo* oldHead = FREE_LIST_HEAD;
+  int c = sizeClass(SIZE(freeBlock->sizeAndTags));
+  BlockInfo* oldHead = FREE_LIST_HEAD(c);
   freeBlock->next = oldHead;
   if (oldHead != NULL) {
     oldHead->prev = freeBlock;
   }
-  //  freeBlock->prev = NULL;
-  FREE_LIST_HEAD = freeBlock;
+  freeBlock->prev = NULL;
+  FREE_LIST_HEAD(c) = freeBlock;
+  PROLOGUE->slBitmap[c >> SL_SHIFT] |= (uint32_t)1 << (c & (SL_COUNT - 1));
+  PROLOGUE->flBitmap |= (uint64_t)1 << (c >> SL_SHIFT);
+  PROLOGUE->freeBytes += SIZE(freeBlock->sizeAndTags);
+  PROLOGUE->freeBlockCounts[c >> SL_SHIFT]++;
 }      
 
-/* Remove a free block from the free list. */
+/* Remove a free block from the free list of its size class. */
 static void removeFreeBlock(BlockInfo* freeBlock) {
   BlockInfo *nextFree, *prevFree;
   
   nextFree = freeBlock->next;
   prevFree = freeBlock->prev;
+  PROLOGUE->freeBytes -= SIZE(freeBlock->sizeAndTags);
+  PROLOGUE->freeBlockCounts[sizeClass(SIZE(freeBlock->sizeAndTags)) >> SL_SHIFT]--;
 
   // If the next block is not null, patch its prev pointer.
   if (nextFree != NULL) {
@@ -170,15 +457,57 @@ static void removeFreeBlock(BlockInfo* freeBlock) {
 
   // If we're removing the head of the free list, set the head to be
   // the next block, otherwise patch the previous block's next pointer.
-  if (freeBlock == FREE_LIST_HEAD) {
-    FREE_LIST_HEAD = nextFree;
+  // The block's size still decides which list it is on.
+  if (prevFree == NULL) {
+    int c = sizeClass(SIZE(freeBlock->sizeAndTags));
+
+    FREE_LIST_HEAD(c) = nextFree;
+    // Keep the bitmaps in step when the list becomes empty.
+    if (nextFree == NULL) {
+      PROLOGUE->slBitmap[c >> SL_SHIFT] &= ~((uint32_t)1 << (c & (SL_COUNT - 1)));
+      if (PROLOGUE->slBitmap[c >> SL_SHIFT] == 0) {
+        PROLOGUE->flBitmap &= ~((uint64_t)1 << (c >> SL_SHIFT));
+      }
+    }
   } else {
     prevFree->next = nextFree;
   }
 }
 
-/* Coalesce 'oldBlock' with any preceeding or following free blocks. */
-static void coalesceFreeBlock(BlockInfo* oldBlock) {
+/* Merging free blocks first..end leaves the header and links of each
+   block but the first, and the boundary tag before it, inside the
+   merged block.  Clear those above freshFrom, which mm_calloc counts
+   on being zero. */
+static void clearSeams(BlockInfo* first, BlockInfo* end) {
+  char* seam = UNSCALED_POINTER_ADD(first, SIZE(first->sizeAndTags));
+  char* from;
+  char* to;
+
+  while (seam < (char*)end) {
+    from = seam - WORD_SIZE;
+    to = seam + sizeof(BlockInfo);
+    seam += SIZE(((BlockInfo*)seam)->sizeAndTags);
+    if (from < PROLOGUE->freshFrom) {
+      from = PROLOGUE->freshFrom;
+    }
+    if (from < to) {
+      memset(from, 0, to - from);
+    }
+  }
+}
+
+/* The used block 'block' may be written up to its end. */
+static void markWritten(BlockInfo* block) {
+  char* end = UNSCALED_POINTER_ADD(block, SIZE(block->sizeAndTags));
+
+  if (end > PROLOGUE->freshFrom) {
+    PROLOGUE->freshFrom = end;
+  }
+}
+
+/* Coalesce 'oldBlock' with any preceeding or following free blocks.
+   Returns the resulting free block. */
+static BlockInfo* coalesceFreeBlock(BlockInfo* oldBlock) {
   BlockInfo *blockCursor;
   BlockInfo *newBlock;
   BlockInfo *freeBlock;
@@ -223,8 +552,12 @@ static void coalesceFreeBlock(BlockInfo* oldBlock) {
   // If the block actually grew, remove the old entry from the free
   // list and add the new entry.
   if (newSize != oldSize) {
+    PROLOGUE->numCoalesces++;
     // Remove the original block from the free list
     removeFreeBlock(oldBlock);
+    if ((char*)blockCursor > PROLOGUE->freshFrom) {
+      clearSeams(newBlock, blockCursor);
+    }
 
     // Save the new size in the block info and in the boundary tag
     // and tag it to show the preceding block is used (otherwise, it
@@ -237,21 +570,150 @@ static void coalesceFreeBlock(BlockInfo* oldBlock) {
     // Put the new block in the free list.
     insertFreeBlock(newBlock);
   }
-  return;
+  return newBlock;
+}
+
+/* The last byte of the heap being worked on. */
+static void* heapHi(void) {
+  return (heap == NULL) ? mem_heap_hi() : heap->brk - 1;
+}
+
+/* The size of the heap being worked on. */
+static size_t heapSize(void) {
+  return (heap == NULL) ? mem_heapsize() : (size_t)(heap->brk - heap->lo);
+}
+
+/* Grow or shrink the heap being worked on, as mem_sbrk does. */
+static void* heapSbrk(int incr) {
+  char* oldBrk;
+  uintptr_t pagesize;
+  uintptr_t start;
+
+  if (heap == NULL) {
+    return mem_sbrk(incr);
+  }
+  oldBrk = heap->brk;
+  if ((incr < 0 && oldBrk + incr < heap->lo) ||
+      (incr > 0 && (size_t)incr > (size_t)(heap->max - oldBrk))) {
+    return (void*)-1;
+  }
+  heap->brk += incr;
+  if (incr < 0) {
+    // Like mem_sbrk, give back the pages past the new end.
+    pagesize = mem_pagesize();
+    start = ((uintptr_t)heap->brk + pagesize - 1) & ~(pagesize - 1);
+    if ((uintptr_t)oldBrk > start) {
+      madvise((void*)start, (uintptr_t)oldBrk - start, MADV_DONTNEED);
+    }
+  }
+  return oldBrk;
+}
+
+/* Return the last block in the heap if it is free, else NULL. */
+static BlockInfo* lastFreeBlock(void) {
+  // The heap-footer word follows the last block.
+  size_t* heapFooter = (size_t*)UNSCALED_POINTER_SUB(heapHi(), WORD_SIZE - 1);
+
+  if (*heapFooter & TAG_PRECEDING_USED) {
+    return NULL;
+  }
+  return (BlockInfo*)UNSCALED_POINTER_SUB(heapFooter, SIZE(heapFooter[-1]));
 }
 
-/* Get more heap space of size at least reqSize. */
-static void requestMoreSpace(size_t reqSize) {
+/* The heap grows by at least growChunk bytes at a time, and growChunk
+   doubles each time, from GROW_CHUNK_MIN up to GROW_CHUNK_MAX; so a
+   heap that keeps growing calls mem_sbrk a logarithmic number of times
+   rather than once per allocation.  To keep a small heap from
+   reserving far more than it uses, the chunk is also held to
+   1/GROW_RATIO of the heap's size. */
+#define GROW_CHUNK_MIN (16 * 1024)
+#define GROW_CHUNK_MAX (4 * 1024 * 1024)
+#define GROW_RATIO 4
+
+/* The most a request may grow the heap by.  Larger ones fail without
+   calling mem_sbrk, which takes an int; with the growth chunk and huge
+   page rounding on top this stays well under INT_MAX. */
+#define HEAP_MAX_REQUEST ((size_t)1 << 30)
+
+/* Built with -DMM_HUGEPAGES, the heap is kept in whole transparent
+   huge pages, to spare programs that roam a large heap most of their
+   TLB misses.  The region the heap lives in is 2 MB-aligned and
+   advised MADV_HUGEPAGE (memlib.c must be built with the flag too);
+   the heap grows to, and is trimmed back to, a huge page boundary;
+   and only whole huge pages are dropped from free blocks, so that the
+   kernel never has to split one.  HEAP_PAGE_SIZE() is the unit the
+   heap grows and gives memory back in. */
+#ifdef MM_HUGEPAGES
+#define HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+#define HEAP_PAGE_SIZE() HUGE_PAGE_SIZE
+/* How much to grow the heap by, at least size bytes, so that it ends
+   on a huge page boundary. */
+#define HUGE_PAGE_END(size) \
+  ((((uintptr_t)heapHi() + 1 + (size) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1)) - \
+   ((uintptr_t)heapHi() + 1))
+#else
+#define HEAP_PAGE_SIZE() mem_pagesize()
+#endif
+
+/* How much the heap would grow by next time, in whole pages. */
+static size_t growthChunk(void) {
+  size_t pagesize = HEAP_PAGE_SIZE();
+  size_t chunk = PROLOGUE->growChunk;
+
+  if (chunk > heapSize() / GROW_RATIO) {
+    chunk = heapSize() / GROW_RATIO;
+  }
+  return (chunk + pagesize - 1) / pagesize * pagesize;
+}
+
+/* Get more heap space of size at least reqSize.  Returns the free
+   block at the end of the heap, which is at least reqSize bytes, or
+   NULL if the heap cannot grow that far. */
+static BlockInfo* requestMoreSpace(size_t reqSize) {
   size_t pagesize = mem_pagesize();
-  size_t numPages = (reqSize + pagesize - 1) / pagesize;
   BlockInfo *newBlock;
-  size_t totalSize = numPages * pagesize;
+  BlockInfo *lastBlock = lastFreeBlock();
+  size_t numPages;
+  size_t minSize;
+  size_t totalSize;
   size_t prevLastWordMask;
 
-  void* mem_sbrk_result = mem_sbrk(totalSize);
-  if ((size_t)mem_sbrk_result == -1) {
-    printf("ERROR: mem_sbrk failed in requestMoreSpace\n");
-    exit(0);
+  // A free block at the end of the heap will merge with the new
+  // space, so only the rest is missing.
+  if (lastBlock != NULL) {
+    if (SIZE(lastBlock->sizeAndTags) >= reqSize) {
+      return lastBlock;
+    }
+    reqSize -= SIZE(lastBlock->sizeAndTags);
+  }
+  if (reqSize > HEAP_MAX_REQUEST) {
+    return NULL;
+  }
+  numPages = (reqSize + pagesize - 1) / pagesize;
+  minSize = numPages * pagesize;
+  totalSize = minSize;
+  if (totalSize < growthChunk()) {
+    totalSize = growthChunk();
+  }
+#ifdef MM_HUGEPAGES
+  // End the heap on a huge page boundary.
+  minSize = HUGE_PAGE_END(minSize);
+  totalSize = HUGE_PAGE_END(totalSize);
+#endif
+
+  void* mem_sbrk_result = heapSbrk(totalSize);
+  if ((ssize_t)mem_sbrk_result == -1 && totalSize > minSize) {
+    // Near the end of its region, the heap may still grow by less.
+    totalSize = minSize;
+    mem_sbrk_result = heapSbrk(totalSize);
+  }
+  if ((ssize_t)mem_sbrk_result == -1) {
+    return NULL;
+  }
+  PROLOGUE->numExtensions++;
+  PROLOGUE->bytesOverReserved += totalSize - reqSize;
+  if (PROLOGUE->growChunk < GROW_CHUNK_MAX) {
+    PROLOGUE->growChunk *= 2;
   }
   newBlock = (BlockInfo*)UNSCALED_POINTER_SUB(mem_sbrk_result, WORD_SIZE);
 
@@ -275,20 +737,75 @@ static void requestMoreSpace(size_t reqSize) {
   // Add the new block to the free list and immediately coalesce newly
   // allocated memory space
   insertFreeBlock(newBlock);
-  coalesceFreeBlock(newBlock);
+  return coalesceFreeBlock(newBlock);
+}
+
+/* Report how often and by how much more than needed the heap grew. */
+void mm_get_growth_stats(struct mm_growth_stats* stats) {
+  stats->extensions = PROLOGUE->numExtensions;
+  stats->bytesOverReserved = PROLOGUE->bytesOverReserved;
+}
+
+
+/* Return the size of the block needed to hold size bytes of payload. */
+static size_t blockSizeFor(size_t size) {
+  // A size the header would wrap around becomes the largest block
+  // size, which no free block holds and the heap never grows by.
+  if (size > SIZE_MAX - WORD_SIZE - OWNER_SIZE - ALIGNMENT) {
+    return SIZE_MAX & ~(size_t)(ALIGNMENT - 1);
+  }
+  // Add one word for the initial size header.
+  // Note that we don't need to boundary tag when the block is used!
+  size += WORD_SIZE + OWNER_SIZE;
+  if (size <= MIN_BLOCK_SIZE) {
+    // Make sure we allocate enough space for a blockInfo in case we
+    // free this block (when we free this block, we'll need to use the
+    // next pointer, the prev pointer, and the boundary tag).
+    return MIN_BLOCK_SIZE;
+  }
+  // Round up for correct alignment
+  return ALIGNMENT * ((size + ALIGNMENT - 1) / ALIGNMENT);
 }
 
+/* Shrink the used block 'block' to newSize bytes if what is left over
+   is big enough to be a block of its own, and free the tail. */
+static void splitUsedBlock(BlockInfo* block, size_t newSize) {
+  size_t blockSize = SIZE(block->sizeAndTags);
+  size_t tailSize = blockSize - newSize;
+  BlockInfo* tail;
+  BlockInfo* followingBlock;
+
+  if (tailSize < MIN_BLOCK_SIZE) {
+    return;
+  }
+  block->sizeAndTags = newSize | (block->sizeAndTags & (TAG_PRECEDING_USED | TAG_USED));
+
+  // The tail is a free block preceded by a used one.
+  tail = (BlockInfo*)UNSCALED_POINTER_ADD(block, newSize);
+  tail->sizeAndTags = tailSize | TAG_PRECEDING_USED;
+  *(size_t*)UNSCALED_POINTER_ADD(tail, tailSize - WORD_SIZE) = tail->sizeAndTags;
+  followingBlock = (BlockInfo*)UNSCALED_POINTER_ADD(tail, tailSize);
+  followingBlock->sizeAndTags &= ~TAG_PRECEDING_USED;
+
+  insertFreeBlock(tail);
+  coalesceFreeBlock(tail);
+}
 
 /* Print the heap by iterating through it as an implicit free list. */
 static void examine_heap() {
   BlockInfo *block;
 
+  int c;
+
   /* print to stderr so output isn't buffered and not output if we crash */
-  fprintf(stderr, "FREE_LIST_HEAD: %p\n", (void *)FREE_LIST_HEAD);
+  for (c = 0; c < NUM_SIZE_CLASSES; c++) {
+    if (FREE_LIST_HEAD(c) != NULL) {
+      fprintf(stderr, "FREE_LIST_HEAD(%d): %p\n", c, (void *)FREE_LIST_HEAD(c));
+    }
+  }
 
-  for (block = (BlockInfo *)UNSCALED_POINTER_ADD(mem_heap_lo(), WORD_SIZE); /* first block on hea\
-									       p */
-       SIZE(block->sizeAndTags) != 0 && (void*)block < (void*)mem_heap_hi();
+  for (block = FIRST_BLOCK; /* first block on heap */
+       SIZE(block->sizeAndTags) != 0 && (void*)block < heapHi();
        block = (BlockInfo *)UNSCALED_POINTER_ADD(block, SIZE(block->sizeAndTags))) {
 
     /* print out common block attributes */
@@ -310,46 +827,582 @@ static void examine_heap() {
   fprintf(stderr, "END OF HEAP\n\n");
 }
 
-/* Initialize the allocator. */
-int mm_init () {
+
+/******** SLABS FOR SMALL OBJECTS ************************************/
+
+
+/* Requests of up to SLAB_MAX_SIZE bytes do not get heap blocks.  They
+   are served from slabs: SLAB_SIZE-byte, SLAB_SIZE-aligned pieces of a
+   region mapped for the purpose, each cut into equal slots of one size
+   class.  A bitmap in the slab's header says which slots are free, so
+   slots have no header of their own and an 8-byte request takes 8
+   bytes instead of MIN_BLOCK_SIZE.  mm_free knows a slot by its
+   address lying inside the region, and finds its slab by rounding the
+   address down to SLAB_SIZE.
+
+   The slabs of each class that have a free slot are kept on a list.
+   A slab whose slots are all free goes on a list of unused slabs for
+   any class to take, unless it is the last slab on its class's list.
+   In the thread-safe build each class has a lock of its own. */
+#define SLAB_SIZE 4096
+
+/* Largest request served from a slab; classes are ALIGNMENT apart. */
+#define SLAB_MAX_SIZE 64
+#define SLAB_CLASSES (SLAB_MAX_SIZE / ALIGNMENT)
+
+/* Address space reserved for slabs.  Pages are only used once a slab
+   is carved from them. */
+#define SLAB_REGION_SIZE ((size_t)1 << 30)
+
+/* Words of free-slot bitmap: enough for SLAB_SIZE / ALIGNMENT slots. */
+#define SLAB_MAP_WORDS (SLAB_SIZE / ALIGNMENT / 64)
+
+struct Slab {
+  // Neighbours in the list of its class, or of unused slabs.
+  struct Slab* next;
+  struct Slab* prev;
+  size_t slotSize;
+  int numSlots;
+  int numFree;
+  // Bit i is set if slot i is free.
+  uint64_t freeMap[SLAB_MAP_WORDS];
+};
+typedef struct Slab Slab;
+
+static char* slabRegion;                 // NULL if it could not be mapped
+static char* slabTop;                    // slabs below here have been used
+static Slab* slabLists[SLAB_CLASSES];    // slabs with a free slot
+static Slab* unusedSlabs;
+#ifdef MM_THREADSAFE
+static pthread_mutex_t slabLocks[SLAB_CLASSES] = {
+  [0 ... SLAB_CLASSES - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+static pthread_mutex_t unusedSlabLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Is p a slot in a slab? */
+#define IS_SLAB_SLOT(p) \
+  (slabRegion != NULL && (size_t)((char*)(p) - slabRegion) < SLAB_REGION_SIZE)
+
+/* The slab holding slot p. */
+#define SLAB_OF(p) ((Slab*)((uintptr_t)(p) & ~(uintptr_t)(SLAB_SIZE - 1)))
+
+/* Address of slot i of a slab. */
+#define SLAB_SLOT(slab, i) UNSCALED_POINTER_ADD(slab, sizeof(Slab) + (size_t)(i) * (slab)->slotSize)
+
+static void pushSlab(Slab** list, Slab* slab) {
+  slab->next = *list;
+  slab->prev = NULL;
+  if (*list != NULL) {
+    (*list)->prev = slab;
+  }
+  *list = slab;
+}
+
+static void removeSlab(Slab** list, Slab* slab) {
+  if (slab->next != NULL) {
+    slab->next->prev = slab->prev;
+  }
+  if (slab->prev != NULL) {
+    slab->prev->next = slab->next;
+  } else {
+    *list = slab->next;
+  }
+}
+
+/* Return a slab of free slots of slotSize bytes, or NULL if the
+   region is used up. */
+static Slab* newSlab(size_t slotSize) {
+  Slab* slab = NULL;
+  int w;
+
+#ifdef MM_THREADSAFE
+  pthread_mutex_lock(&unusedSlabLock);
+#endif
+  if (unusedSlabs != NULL) {
+    slab = unusedSlabs;
+    removeSlab(&unusedSlabs, slab);
+  } else if (slabTop < slabRegion + SLAB_REGION_SIZE) {
+    slab = (Slab*)slabTop;
+    slabTop += SLAB_SIZE;
+  }
+#ifdef MM_THREADSAFE
+  pthread_mutex_unlock(&unusedSlabLock);
+#endif
+  if (slab == NULL) {
+    return NULL;
+  }
+
+  slab->slotSize = slotSize;
+  slab->numSlots = (SLAB_SIZE - sizeof(Slab)) / slotSize;
+  slab->numFree = slab->numSlots;
+  for (w = 0; w < SLAB_MAP_WORDS; w++) {
+    if (w < slab->numSlots / 64) {
+      slab->freeMap[w] = ~(uint64_t)0;
+    } else if (w == slab->numSlots / 64) {
+      slab->freeMap[w] = ((uint64_t)1 << (slab->numSlots % 64)) - 1;
+    } else {
+      slab->freeMap[w] = 0;
+    }
+  }
+  return slab;
+}
+
+/* Return a free slot of at least size bytes, or NULL if there are no
+   more slabs. */
+static void* slabAllocate(size_t size) {
+  int c = (size - 1) / ALIGNMENT;
+  Slab* slab;
+  void* slot = NULL;
+  int w;
+
+#ifdef MM_THREADSAFE
+  pthread_mutex_lock(&slabLocks[c]);
+#endif
+  slab = slabLists[c];
+  if (slab == NULL && (slab = newSlab((c + 1) * ALIGNMENT)) != NULL) {
+    pushSlab(&slabLists[c], slab);
+  }
+  if (slab != NULL) {
+    for (w = 0; slab->freeMap[w] == 0; w++) {
+    }
+    slot = SLAB_SLOT(slab, w * 64 + __builtin_ctzll(slab->freeMap[w]));
+    slab->freeMap[w] &= slab->freeMap[w] - 1; // clear the lowest set bit
+    if (--slab->numFree == 0) { // full: no longer a candidate
+      removeSlab(&slabLists[c], slab);
+    }
+  }
+#ifdef MM_THREADSAFE
+  pthread_mutex_unlock(&slabLocks[c]);
+#endif
+  return slot;
+}
+
+/* Store up to n free slots of at least size bytes in ptrs, taking the
+   class's lock once.  Returns how many were found, fewer than n only
+   if there are no more slabs. */
+static size_t slabAllocateBatch(size_t size, void** ptrs, size_t n) {
+  int c = (size - 1) / ALIGNMENT;
+  Slab* slab;
+  size_t done = 0;
+  int w;
+
+#ifdef MM_THREADSAFE
+  pthread_mutex_lock(&slabLocks[c]);
+#endif
+  while (done < n) {
+    slab = slabLists[c];
+    if (slab == NULL) {
+      if ((slab = newSlab((c + 1) * ALIGNMENT)) == NULL) {
+        break;
+      }
+      pushSlab(&slabLists[c], slab);
+    }
+    for (w = 0; w < SLAB_MAP_WORDS && done < n; w++) {
+      while (slab->freeMap[w] != 0 && done < n) {
+        ptrs[done++] = SLAB_SLOT(slab, w * 64 + __builtin_ctzll(slab->freeMap[w]));
+        slab->freeMap[w] &= slab->freeMap[w] - 1;
+        slab->numFree--;
+      }
+    }
+    if (slab->numFree == 0) {
+      removeSlab(&slabLists[c], slab);
+    }
+  }
+#ifdef MM_THREADSAFE
+  pthread_mutex_unlock(&slabLocks[c]);
+#endif
+  return done;
+}
+
+/* Free the slab slot ptr. */
+static void slabFree(void* ptr) {
+  Slab* slab = SLAB_OF(ptr);
+  // The slot size cannot change while this slot is in use.
+  int c = slab->slotSize / ALIGNMENT - 1;
+  int i = ((char*)ptr - (char*)SLAB_SLOT(slab, 0)) / slab->slotSize;
+
+#ifdef MM_THREADSAFE
+  pthread_mutex_lock(&slabLocks[c]);
+#endif
+  slab->freeMap[i / 64] |= (uint64_t)1 << (i % 64);
+  if (slab->numFree++ == 0) { // was full
+    pushSlab(&slabLists[c], slab);
+  } else if (slab->numFree == slab->numSlots &&
+             (slabLists[c] != slab || slab->next != NULL)) {
+    // Empty, and not the class's only slab: let any class reuse it.
+    removeSlab(&slabLists[c], slab);
+#ifdef MM_THREADSAFE
+    pthread_mutex_lock(&unusedSlabLock);
+#endif
+    pushSlab(&unusedSlabs, slab);
+#ifdef MM_THREADSAFE
+    pthread_mutex_unlock(&unusedSlabLock);
+#endif
+  }
+#ifdef MM_THREADSAFE
+  pthread_mutex_unlock(&slabLocks[c]);
+#endif
+}
+
+
+/******** HEAP TRIMMING *********************************************/
+
+
+/* Free memory at the end of the heap goes back to the system by
+   shrinking the heap.  mm_free does this by itself when it leaves a
+   free block of trimThreshold bytes or more at the end of the heap,
+   and mm_trim does it on request.  Free memory anywhere else in the
+   heap cannot be given back that way, so mm_trim also tells the system
+   with madvise that the pages inside large free blocks (and unused
+   slabs) may be dropped: they stop counting towards the resident set
+   and come back zeroed when next touched.
+
+   As in glibc, trimThreshold starts at 128 KB and is kept at twice
+   the mmap threshold when that adapts. */
+#define TRIM_THRESHOLD_MIN (128 * 1024)
+
+static size_t trimThreshold = TRIM_THRESHOLD_MIN;
+// Cleared once mem_sbrk has refused to shrink the heap.
+static int sbrkShrinks = 1;
+
+/* Let the system drop the whole pages inside the free block freeBlock,
+   between its free-list links and its boundary tag.  Returns nonzero
+   if there were any. */
+static int adviseFreeBlock(BlockInfo* freeBlock) {
+  uintptr_t pagesize = HEAP_PAGE_SIZE();
+  uintptr_t start = ((uintptr_t)(freeBlock + 1) + pagesize - 1) & ~(pagesize - 1);
+  uintptr_t end = ((uintptr_t)freeBlock + SIZE(freeBlock->sizeAndTags) - WORD_SIZE) & ~(pagesize - 1);
+
+  if (end <= start) {
+    return 0;
+  }
+  return madvise((void*)start, end - start, MADV_DONTNEED) == 0;
+}
+
+/* Shrink the heap so that no more than pad bytes (but at least a
+   minimum block) of free space are left at its end.  If mem_sbrk will
+   not shrink the heap, drop the pages of the last block instead.
+   Returns nonzero if any memory was released. */
+static int trimTop(size_t pad) {
+  BlockInfo* last = lastFreeBlock();
+  size_t pagesize = mem_pagesize();
+  size_t unit = HEAP_PAGE_SIZE();
+  size_t lastSize, keep, release;
+  char* end;
+
+  if (last == NULL) {
+    return 0;
+  }
+  lastSize = SIZE(last->sizeAndTags);
+  keep = (pad < MIN_BLOCK_SIZE) ? MIN_BLOCK_SIZE : SIZE(pad + ALIGNMENT - 1);
+  if (lastSize < keep + unit) {
+    return 0;
+  }
+  if (!sbrkShrinks) {
+    return adviseFreeBlock(last);
+  }
+  release = (lastSize - keep) / unit * unit;
+  if (release > INT_MAX) { // mem_sbrk takes an int
+    release = INT_MAX / unit * unit;
+  }
+
+  // The block changes size, and so list.
+  removeFreeBlock(last);
+  if ((ssize_t)heapSbrk(-(int)release) == -1) {
+    sbrkShrinks = 0;
+    insertFreeBlock(last);
+    return adviseFreeBlock(last);
+  }
+  lastSize -= release;
+  last->sizeAndTags = lastSize | TAG_PRECEDING_USED;
+  *(size_t*)UNSCALED_POINTER_ADD(last, lastSize - WORD_SIZE) = last->sizeAndTags;
+  // The new heap-footer.
+  *(size_t*)UNSCALED_POINTER_ADD(last, lastSize) = TAG_USED;
+  insertFreeBlock(last);
+  // mem_sbrk released the whole pages past the new end of the heap,
+  // so they will come back zeroed.
+  end = (char*)(((uintptr_t)heapHi() + pagesize) & ~(uintptr_t)(pagesize - 1));
+  if (PROLOGUE->freshFrom > end) {
+    PROLOGUE->freshFrom = end;
+  }
+  return 1;
+}
+
+/* Give free memory back to the system: shrink the heap to at most pad
+   bytes of free space at its end, and drop the pages inside the other
+   large free blocks and the unused slabs.  Returns 1 if any memory was
+   released, else 0. */
+int mm_trim(size_t pad) {
+  int released;
+  int c;
+  BlockInfo* block;
+  Slab* slab;
+
+#ifdef MM_THREADSAFE
+  pthread_mutex_lock(&heapLock);
+#endif
+#ifdef MM_QUICKLISTS
+  flushQuickLists();
+#endif
+  released = trimTop(pad);
+  // Smaller blocks seldom hold a whole page.
+  for (c = sizeClass(2 * HEAP_PAGE_SIZE()); c < NUM_SIZE_CLASSES; c++) {
+    for (block = FREE_LIST_HEAD(c); block != NULL; block = block->next) {
+      released |= adviseFreeBlock(block);
+    }
+  }
+#ifdef MM_THREADSAFE
+  pthread_mutex_unlock(&heapLock);
+  pthread_mutex_lock(&unusedSlabLock);
+#endif
+  for (slab = unusedSlabs; slab != NULL; slab = slab->next) {
+    // Keep the links in the first page; newSlab rewrites the rest.
+    if (SLAB_SIZE > mem_pagesize()) {
+      released |= madvise(UNSCALED_POINTER_ADD(slab, mem_pagesize()),
+                          SLAB_SIZE - mem_pagesize(), MADV_DONTNEED) == 0;
+    }
+  }
+#ifdef MM_THREADSAFE
+  pthread_mutex_unlock(&unusedSlabLock);
+#endif
+  return released != 0;
+}
+
+
+/******** MAPPED BLOCKS FOR HUGE REQUESTS ****************************/
+
+
+/* Requests of mmapThreshold bytes or more get an anonymous mapping of
+   their own instead of a heap block, so that their memory goes back
+   to the system as soon as they are freed rather than growing the
+   heap for good.  The block header in the first page of the mapping
+   holds the length of the mapping and TAG_MMAPPED.
+
+   As in glibc, the threshold adapts to the program.  Freeing a mapped
+   block larger than the threshold raises the threshold to its size
+   (up to MMAP_THRESHOLD_MAX): a program that allocates blocks of that
+   size once will likely do so again, and those are better recycled
+   from the heap than mapped and unmapped each time.  Setting the
+   threshold with mm_set_mmap_threshold turns this off. */
+#define MMAP_THRESHOLD_MIN (128 * 1024)
+#define MMAP_THRESHOLD_MAX (32 * 1024 * 1024)
+
+static size_t mmapThreshold = MMAP_THRESHOLD_MIN;
+static int mmapThresholdFixed;
+// Bytes in mapped blocks.
+static size_t mappedBytes;
+
+/* Fix the size from which requests are given their own mapping. */
+void mm_set_mmap_threshold(size_t threshold) {
+  __atomic_store_n(&mmapThreshold, threshold, __ATOMIC_RELAXED);
+  mmapThresholdFixed = 1;
+}
+
+/* The block header goes MAP_OFFSET bytes into the first page of its
+   mapping, so that the payload after it is aligned.  An aligned block
+   (see mapAlignedBlock) may put it further in, but always in the
+   first page. */
+#define MAP_OFFSET (ALIGNMENT - WORD_SIZE)
+
+/* The start of the mapping holding the mapped block 'block'. */
+#define MAP_START(block) \
+  ((void*)((uintptr_t)(block) & ~(uintptr_t)(mem_pagesize() - 1)))
+
+/* Return a mapped block of at least size bytes of payload, or NULL if
+   the mapping fails or its size would overflow. */
+static void* mapBlock(size_t size) {
+  size_t pagesize = mem_pagesize();
+  size_t mapSize;
+  void* map;
+  BlockInfo* block;
+
+  if (size > SIZE_MAX - MAP_OFFSET - WORD_SIZE - pagesize) {
+    return NULL;
+  }
+  mapSize = (MAP_OFFSET + size + WORD_SIZE + pagesize - 1) / pagesize * pagesize;
+  map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  block = UNSCALED_POINTER_ADD(map, MAP_OFFSET);
+  block->sizeAndTags = mapSize | TAG_MMAPPED | TAG_USED;
+  __atomic_fetch_add(&mappedBytes, mapSize, __ATOMIC_RELAXED);
+  return UNSCALED_POINTER_ADD(block, WORD_SIZE);
+}
+
+/* Return a mapped block of at least size bytes of payload aligned to
+   alignment, a power of two, or NULL if the mapping fails or its size
+   would overflow.  The pages mapped only to find an aligned address
+   are unmapped again. */
+static void* mapAlignedBlock(size_t alignment, size_t size) {
+  uintptr_t pagesize = mem_pagesize();
+  size_t mapSize;
+  char* map;
+  char *payload, *start, *end;
+  BlockInfo* block;
+
+  if (alignment > SIZE_MAX - WORD_SIZE - pagesize ||
+      size > SIZE_MAX - WORD_SIZE - pagesize - alignment) {
+    return NULL;
+  }
+  mapSize = (size + WORD_SIZE + alignment + pagesize - 1) / pagesize * pagesize;
+  map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  payload = (char*)(((uintptr_t)map + WORD_SIZE + alignment - 1) & ~(uintptr_t)(alignment - 1));
+  block = (BlockInfo*)(payload - WORD_SIZE);
+  start = MAP_START(block);
+  end = (char*)(((uintptr_t)payload + size + pagesize - 1) & ~(pagesize - 1));
+  if (start > map) {
+    munmap(map, start - map);
+  }
+  if (end < map + mapSize) {
+    munmap(end, map + mapSize - end);
+  }
+  block->sizeAndTags = (end - start) | TAG_MMAPPED | TAG_USED;
+  __atomic_fetch_add(&mappedBytes, end - start, __ATOMIC_RELAXED);
+  return payload;
+}
+
+/* Give a mapped block back to the system. */
+static void unmapBlock(BlockInfo* block) {
+  size_t mapSize = SIZE(block->sizeAndTags);
+
+  if (!mmapThresholdFixed && mapSize > __atomic_load_n(&mmapThreshold, __ATOMIC_RELAXED) &&
+      mapSize <= MMAP_THRESHOLD_MAX) {
+    __atomic_store_n(&mmapThreshold, mapSize, __ATOMIC_RELAXED);
+    __atomic_store_n(&trimThreshold, 2 * mapSize, __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_sub(&mappedBytes, mapSize, __ATOMIC_RELAXED);
+  munmap(MAP_START(block), mapSize);
+}
+
+/* Resize a mapped block to hold size bytes, moving it if need be.
+   Returns the new payload pointer, or NULL if the mapping cannot be
+   resized or its size would overflow. */
+static void* remapBlock(BlockInfo* block, size_t size) {
+  size_t pagesize = mem_pagesize();
+  char* map = MAP_START(block);
+  size_t offset = (char*)block - map;
+  size_t oldSize = SIZE(block->sizeAndTags);
+  size_t mapSize;
+
+  if (size > SIZE_MAX - offset - WORD_SIZE - pagesize) {
+    return NULL;
+  }
+  mapSize = (offset + size + WORD_SIZE + pagesize - 1) / pagesize * pagesize;
+  map = mremap(map, oldSize, mapSize, MREMAP_MAYMOVE);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  __atomic_fetch_add(&mappedBytes, mapSize - oldSize, __ATOMIC_RELAXED);
+  block = UNSCALED_POINTER_ADD(map, offset);
+  block->sizeAndTags = mapSize | TAG_MMAPPED | TAG_USED;
+  return UNSCALED_POINTER_ADD(block, WORD_SIZE);
+}
+
+
+/* Lay out the empty heap being worked on: its prologue, one free
+   block and the heap-footer.  Returns -1 if it cannot grow to hold
+   them. */
+static int initHeap(void) {
   // Head of the free list.
   BlockInfo *firstFreeBlock;
 
-  // Initial heap size: WORD_SIZE byte heap-header (stores pointer to head
-  // of free list), MIN_BLOCK_SIZE bytes of space, WORD_SIZE byte heap-footer.
-  size_t initSize = WORD_SIZE+MIN_BLOCK_SIZE+WORD_SIZE;
+  // Initial heap size: the prologue (stores the heads of the free
+  // lists), MIN_BLOCK_SIZE bytes of space, WORD_SIZE byte heap-footer.
+  size_t initSize = PROLOGUE_SIZE+MIN_BLOCK_SIZE+WORD_SIZE;
+  int c;
   size_t totalSize;
 
-  void* mem_sbrk_result = mem_sbrk(initSize);
-  //  printf("mem_sbrk returned %p\n", mem_sbrk_result);
-  if ((ssize_t)mem_sbrk_result == -1) {
-    printf("ERROR: mem_sbrk failed in mm_init, returning %p\n", 
-           mem_sbrk_result);
-    exit(1);
+  if ((ssize_t)heapSbrk(initSize) == -1) {
+    return -1;
   }
 
-  firstFreeBlock = (BlockInfo*)UNSCALED_POINTER_ADD(mem_heap_lo(), WORD_SIZE);
+  firstFreeBlock = FIRST_BLOCK;
 
-  // Total usable size is full size minus heap-header and heap-footer words
+  // Total usable size is full size minus the prologue and heap-footer word
   // NOTE: These are different than the "header" and "footer" of a block!
-  // The heap-header is a pointer to the first free block in the free list.
+  // The prologue holds the heads of the free lists.
   // The heap-footer is used to keep the data structures consistent (see
   // requestMoreSpace() for more info, but you should be able to ignore it).
-  totalSize = initSize - WORD_SIZE - WORD_SIZE;
+  totalSize = initSize - PROLOGUE_SIZE - WORD_SIZE;
 
   // The heap starts with one free block, which we initialize now.
   firstFreeBlock->sizeAndTags = totalSize | TAG_PRECEDING_USED;
-  firstFreeBlock->next = NULL;
-  firstFreeBlock->prev = NULL;
   // boundary tag
   *((size_t*)UNSCALED_POINTER_ADD(firstFreeBlock, totalSize - WORD_SIZE)) = totalSize | TAG_PRECEDING_USED;
   
   // Tag "useless" word at end of heap as used.
   // This is the is the heap-footer.
-  *((size_t*)UNSCALED_POINTER_SUB(mem_heap_hi(), WORD_SIZE - 1)) = TAG_USED;
+  *((size_t*)UNSCALED_POINTER_SUB(heapHi(), WORD_SIZE - 1)) = TAG_USED;
+
+  // Empty every free list, then put this new free block on its list.
+  // (The heap may be reused memory, so nothing can be assumed zero.)
+  for (c = 0; c < NUM_SIZE_CLASSES; c++) {
+    FREE_LIST_HEAD(c) = NULL;
+  }
+  PROLOGUE->flBitmap = 0;
+  PROLOGUE->growChunk = GROW_CHUNK_MIN;
+  PROLOGUE->numExtensions = 0;
+  PROLOGUE->bytesOverReserved = 0;
+  PROLOGUE->freeBytes = 0;
+  for (c = 0; c < FL_COUNT; c++) {
+    PROLOGUE->freeBlockCounts[c] = 0;
+  }
+  PROLOGUE->numMallocs = 0;
+  PROLOGUE->numFrees = 0;
+  PROLOGUE->numCoalesces = 0;
+  PROLOGUE->freshFrom = UNSCALED_POINTER_ADD(heapHi(), 1);
+#ifdef MM_QUICKLISTS
+  for (c = 0; c < QUICK_BINS; c++) {
+    PROLOGUE->quickLists[c] = NULL;
+  }
+  PROLOGUE->quickBytes = 0;
+#endif
+  for (c = 0; c < FL_COUNT; c++) {
+    PROLOGUE->slBitmap[c] = 0;
+  }
+  insertFreeBlock(firstFreeBlock);
+  return 0;
+}
+
+/* Initialize the allocator.  Returns -1 if the heap cannot be set up. */
+int mm_init () {
+  int c;
+
+  heap = NULL;
+  heapLo = mem_heap_lo();
+  if (initHeap() < 0) {
+    return -1;
+  }
+
+  // Map the slab region once and start it over on every mm_init.
+  if (slabRegion == NULL) {
+    slabRegion = mmap(NULL, SLAB_REGION_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (slabRegion == MAP_FAILED) {
+      slabRegion = NULL; // small requests will use the heap
+    }
+  }
+  slabTop = slabRegion;
+  unusedSlabs = NULL;
+  for (c = 0; c < SLAB_CLASSES; c++) {
+    slabLists[c] = NULL;
+  }
 
-  // set the head of the free list to this new free block.
-  FREE_LIST_HEAD = firstFreeBlock;
+#ifdef MM_THREADSAFE
+  // Done here rather than on a thread's first call, since either may
+  // allocate memory, and inside mm_malloc that would deadlock.
+  pthread_once(&cacheKeyOnce, makeCacheKey);
+  // Every cached block belonged to the old heap.
+  memset(threadCaches, 0, sizeof(threadCaches));
+  uncachedMallocs = 0;
+  uncachedFrees = 0;
+  cacheGeneration++;
+#endif
   return 0;
 }
 
@@ -357,43 +1410,51 @@ int mm_init () {
 // TOP-LEVEL ALLOCATOR INTERFACE ------------------------------------
 
 
-/* Allocate a block of size size and return a pointer to it. */
-void* mm_malloc (size_t size) {
-  size_t reqSize;
-  BlockInfo * ptrFreeBlock = NULL;
-  size_t blockSize;
-  size_t precedingBlockUseTag;
+/* Find a free block of at least reqSize bytes, merging the blocks on
+   the quick lists if the free lists have none.  Returns NULL if there
+   is still none. */
+static BlockInfo* findFreeBlock(size_t reqSize) {
+  BlockInfo* block = searchFreeList(reqSize);
 
-  // Zero-size requests get NULL.
-  if (size == 0) {
-    return NULL;
+#ifdef MM_QUICKLISTS
+  if (block == NULL && PROLOGUE->quickBytes != 0) {
+    flushQuickLists();
+    block = searchFreeList(reqSize);
   }
+#endif
+  return block;
+}
 
-  // Add one word for the initial size header.
-  // Note that we don't need to boundary tag when the block is used!
-  size += WORD_SIZE;
-  if (size <= MIN_BLOCK_SIZE) {
-    // Make sure we allocate enough space for a blockInfo in case we
-    // free this block (when we free this block, we'll need to use the
-    // next pointer, the prev pointer, and the boundary tag).
-    reqSize = MIN_BLOCK_SIZE;
-  } else {
-    // Round up for correct alignment
-    reqSize = ALIGNMENT * ((size + ALIGNMENT - 1) / ALIGNMENT);
-  }
+/* Take a used block of at least reqSize bytes from the heap, or
+   return NULL if the heap is out of room. */
+static BlockInfo* allocateBlock(size_t reqSize) {
+  BlockInfo * ptrFreeBlock = NULL;
+  size_t blockSize;
+  size_t precedingBlockUseTag;
 
   // Implement mm_malloc.  You can change or remove any of the above
   // code.  It is included as a suggestion of where to start.
   // You will want to replace this return statement...
 
-  ptrFreeBlock = searchFreeList(reqSize); // uses searchFreeList function to find free space
+#ifdef MM_QUICKLISTS
+  if (reqSize <= QUICK_MAX_SIZE &&
+      (ptrFreeBlock = PROLOGUE->quickLists[QUICK_BIN(reqSize)]) != NULL) { // an exact fit, still marked used
+    PROLOGUE->quickLists[QUICK_BIN(reqSize)] = ptrFreeBlock->next;
+    PROLOGUE->quickBytes -= reqSize;
+    return ptrFreeBlock;
+  }
+#endif
+
+  ptrFreeBlock = findFreeBlock(reqSize); // uses findFreeBlock function to find free space
   if (ptrFreeBlock != NULL) { // if there is free space
     removeFreeBlock(ptrFreeBlock); // once occupied we remove the free space
   }
 
   else { // if there is no free space
-    requestMoreSpace(reqSize); // request more space
-    ptrFreeBlock = searchFreeList(reqSize); // sets our variable to the free space we requested
+    ptrFreeBlock = requestMoreSpace(reqSize); // request more space, we get back the free block it is in
+    if (ptrFreeBlock == NULL) { // the heap cannot grow
+      return NULL;
+    }
     removeFreeBlock(ptrFreeBlock); // once occupied we remove the free space
   }
 
@@ -408,7 +1469,7 @@ void* mm_malloc (size_t size) {
 
   else { // if it is too large
     BlockInfo* FreeBlock = (BlockInfo*) UNSCALED_POINTER_ADD(ptrFreeBlock, reqSize); // frees the block
-    size_t* FreeBlockFooter = FreeBlock->sizeAndTags; // set point to the size and tag
+    size_t* FreeBlockFooter; // points to the footer of the remaining free block
     ptrFreeBlock->sizeAndTags = reqSize | precedingBlockUseTag | TAG_USED; // set the size and tag
     FreeBlock->sizeAndTags = (blockSize - reqSize) | TAG_PRECEDING_USED; //set the block tag to used
     FreeBlockFooter = (size_t*) UNSCALED_POINTER_ADD(ptrFreeBlock, blockSize - WORD_SIZE); // set the footer
@@ -416,41 +1477,1086 @@ void* mm_malloc (size_t size) {
     insertFreeBlock(FreeBlock); // call function to insert free block
   }
 
-  return UNSCALED_POINTER_ADD(ptrFreeBlock, WORD_SIZE);
+  markWritten(ptrFreeBlock);
+  return ptrFreeBlock;
 }
 
-/* Free the block referenced by ptr. */
-void mm_free (void *ptr) {
+/* Give the used block blockInfo back to the heap, merging it with its
+   free neighbours. */
+static void releaseBlockNow(BlockInfo* blockInfo) {
   size_t payloadSize;
-  BlockInfo * blockInfo;
   BlockInfo * followingBlock;
 
   // Implement mm_free.  You can change or remove the declaraions
   // above.  They are included as minor hints.
 
-  blockInfo = (BlockInfo*)UNSCALED_POINTER_SUB(ptr, WORD_SIZE); // set variable to pointer to start
   payloadSize = SIZE(blockInfo->sizeAndTags); // set size of block
+  blockInfo->sizeAndTags = blockInfo->sizeAndTags & (~TAG_USED); // update the tag of the block first, it picks the list
+  *((size_t*)UNSCALED_POINTER_ADD(blockInfo, payloadSize-WORD_SIZE)) = blockInfo->sizeAndTags; // updates begining and end 
+  followingBlock = (BlockInfo*)UNSCALED_POINTER_ADD(blockInfo, payloadSize); // the block after this one
+  followingBlock->sizeAndTags = followingBlock->sizeAndTags & (~TAG_PRECEDING_USED); // no longer preceded by a used block
   insertFreeBlock(blockInfo); // call function to insert free block
-  *((int*)UNSCALED_POINTER_ADD(blockInfo, payloadSize-WORD_SIZE)) = blockInfo->sizeAndTags; // updates begining and end 
-  coalesceFreeBlock(blockInfo); // puts the blocks together
-  blockInfo->sizeAndTags = blockInfo->sizeAndTags & (~TAG_USED); // update the tag of the block
-  return UNSCALED_POINTER_ADD(ptr, WORD_SIZE);
+  blockInfo = coalesceFreeBlock(blockInfo); // puts the blocks together
+  if (SIZE(blockInfo->sizeAndTags) >= __atomic_load_n(&trimThreshold, __ATOMIC_RELAXED) &&
+      blockInfo == lastFreeBlock()) { // a lot of free space at the end
+    trimTop(growthChunk()); // but keep what we would grow by again
+  }
 }
 
+#ifdef MM_QUICKLISTS
+/* Merge every block on the quick lists into the free lists. */
+static void flushQuickLists(void) {
+  BlockInfo* block;
+  int bin;
 
-// Implement a heap consistency checker as needed.
-int mm_check() {
-/* Print the heap by iterating through it as an implicit free list. */
-//  BlockInfo *block;
-
-/* print to stderr so output isn't buffered and not output if we crash */
-//  fprintf(stderr, "FREE_LIST_HEAD: %p\n", (void *)FREE_LIST_HEAD);
+  for (bin = 0; bin < QUICK_BINS; bin++) {
+    while ((block = PROLOGUE->quickLists[bin]) != NULL) {
+      PROLOGUE->quickLists[bin] = block->next;
+      releaseBlockNow(block);
+    }
+  }
+  PROLOGUE->quickBytes = 0;
+}
+#endif
+
+/* Give the used block blockInfo back to the heap. */
+static void releaseBlock(BlockInfo* blockInfo) {
+#ifdef MM_QUICKLISTS
+  size_t blockSize = SIZE(blockInfo->sizeAndTags);
+  BlockInfo* followingBlock = (BlockInfo*)UNSCALED_POINTER_ADD(blockInfo, blockSize);
+
+  // Blocks at the end of the heap, or before the free space there, are
+  // merged at once, so that the heap can still shrink.
+  if ((followingBlock->sizeAndTags & TAG_USED) == 0) {
+    followingBlock = (BlockInfo*)UNSCALED_POINTER_ADD(followingBlock, SIZE(followingBlock->sizeAndTags));
+  }
+  if (blockSize <= QUICK_MAX_SIZE && SIZE(followingBlock->sizeAndTags) != 0) { // merge it later
+    blockInfo->next = PROLOGUE->quickLists[QUICK_BIN(blockSize)];
+    PROLOGUE->quickLists[QUICK_BIN(blockSize)] = blockInfo;
+    PROLOGUE->quickBytes += blockSize;
+    if (PROLOGUE->quickBytes > QUICK_MAX_BYTES) {
+      flushQuickLists();
+    }
+    return;
+  }
+  // A large block may free enough to trim the heap, unless the quick
+  // lists hold on to blocks in the way.
+  if (blockSize >= QUICK_MAX_BYTES && PROLOGUE->quickBytes != 0) {
+    flushQuickLists();
+  }
+#endif
+  releaseBlockNow(blockInfo);
+}
 
-//  for (block = (BlockInfo *)UNSCALED_POINTER_ADD(mem_heap_lo(), WORD_SIZE); /* first block on heap */
-//    SIZE(block->sizeAndTags) != 0 && block < mem_heap_hi();
-//    block = (BlockInfo *)UNSCALED_POINTER_ADD(block, SIZE(block->sizeAndTags))) {
+/* Take a used block of at least reqSize bytes from the heap whose
+   payload is aligned to alignment, a power of two larger than
+   ALIGNMENT.  It is cut out of a block big enough to hold it at an
+   aligned address with room for a free block in front, and what is
+   left before and after it goes back to the free lists.  Returns NULL
+   if the heap is out of room. */
+static BlockInfo* allocateAlignedBlock(size_t alignment, size_t reqSize) {
+  BlockInfo* block = allocateBlock(reqSize + alignment + MIN_BLOCK_SIZE);
+  uintptr_t payload;
+  size_t lead, blockSize;
+  BlockInfo* aligned;
+
+  if (block == NULL) {
+    return NULL;
+  }
+  payload = ((uintptr_t)block + WORD_SIZE + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  lead = payload - WORD_SIZE - (uintptr_t)block;
+  blockSize = SIZE(block->sizeAndTags);
 
-/* print out common block attributes */
+  // Too little room in front for a free block: take the next one.
+  while (lead != 0 && lead < MIN_BLOCK_SIZE) {
+    lead += alignment;
+  }
+  if (lead != 0) {
+    aligned = (BlockInfo*)UNSCALED_POINTER_ADD(block, lead);
+    aligned->sizeAndTags = (blockSize - lead) | TAG_USED;
+    block->sizeAndTags = lead | (block->sizeAndTags & TAG_PRECEDING_USED) | TAG_USED;
+    releaseBlockNow(block); // the header above says it is free
+    block = aligned;
+  }
+  splitUsedBlock(block, reqSize);
+  return block;
+}
+
+/* The most a batch takes from the heap at once. */
+#define BATCH_MAX_BYTES (256 * 1024)
+
+/* Cut up to n used blocks of reqSize bytes out of one free block, and
+   store their payload pointers in ptrs.  Returns how many: 0 if the
+   heap is out of room. */
+static size_t carveBlocks(size_t reqSize, void** ptrs, size_t n) {
+  size_t count = (n < BATCH_MAX_BYTES / reqSize) ? n : BATCH_MAX_BYTES / reqSize;
+  BlockInfo* block;
+  BlockInfo* followingBlock;
+  size_t blockSize, i;
+
+  if (count == 0) {
+    count = 1;
+  }
+  block = findFreeBlock(count * reqSize);
+  if (block == NULL) {
+    block = requestMoreSpace(count * reqSize);
+    if (block == NULL) {
+      return 0;
+    }
+  }
+  removeFreeBlock(block);
+  blockSize = SIZE(block->sizeAndTags);
+
+  // All but the last are reqSize; the last takes the rest for now.
+  block->sizeAndTags = reqSize | (block->sizeAndTags & TAG_PRECEDING_USED) | TAG_USED;
+  for (i = 0; i < count; i++) {
+    ptrs[i] = UNSCALED_POINTER_ADD(block, WORD_SIZE);
+    if (i + 1 < count) {
+      block = (BlockInfo*)UNSCALED_POINTER_ADD(block, reqSize);
+      block->sizeAndTags = reqSize | TAG_PRECEDING_USED | TAG_USED;
+      blockSize -= reqSize;
+    }
+  }
+  block->sizeAndTags = blockSize | (block->sizeAndTags & TAG_PRECEDING_USED) | TAG_USED;
+  followingBlock = (BlockInfo*)UNSCALED_POINTER_ADD(block, blockSize);
+  followingBlock->sizeAndTags |= TAG_PRECEDING_USED;
+  splitUsedBlock(block, reqSize);
+  markWritten(block);
+  return count;
+}
+
+#ifdef MM_THREADSAFE
+/* Give up to n blocks of a cache bin back to the heap. */
+static void flushBin(ThreadCache* cache, int bin, int n) {
+  BlockInfo* block;
+
+  pthread_mutex_lock(&heapLock);
+  while (n-- > 0 && (block = cache->bins[bin]) != NULL) {
+    cache->bins[bin] = block->next;
+    cache->binCounts[bin]--;
+    releaseBlock(block);
+  }
+  pthread_mutex_unlock(&heapLock);
+}
+
+/* Put a block owned by cache into its bin. */
+static void cacheBlock(ThreadCache* cache, BlockInfo* block) {
+  int bin = CACHE_BIN(USED_SIZE(block));
+
+  block->next = cache->bins[bin];
+  cache->bins[bin] = block;
+  if (++cache->binCounts[bin] > CACHE_BIN_MAX) {
+    flushBin(cache, bin, CACHE_BIN_MAX / 2);
+  }
+}
+
+/* Move the blocks other threads have freed into their bins. */
+static void drainRemoteFrees(ThreadCache* cache) {
+  BlockInfo* block = __atomic_exchange_n(&cache->remoteFrees, NULL, __ATOMIC_ACQUIRE);
+  BlockInfo* next;
+
+  for (; block != NULL; block = next) {
+    next = block->next;
+    cacheBlock(cache, block);
+  }
+}
+
+/* Hand a block freed by this thread to the thread that owns it.
+   Returns 0 if the owner has exited and closed its list. */
+static int pushRemoteFree(ThreadCache* owner, BlockInfo* block) {
+  BlockInfo* head = __atomic_load_n(&owner->remoteFrees, __ATOMIC_RELAXED);
+
+  do {
+    if (head == REMOTE_CLOSED) {
+      return 0;
+    }
+    block->next = head;
+  } while (!__atomic_compare_exchange_n(&owner->remoteFrees, &head, block, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  return 1;
+}
+
+/* Thread exit: give the thread's blocks back to the heap and its
+   cache to the next thread that needs one.  Its remoteFrees list is
+   closed, and whatever other threads pushed onto it after the first
+   drain goes back to the heap too. */
+static void releaseCache(void* arg) {
+  ThreadCache* cache = arg;
+  BlockInfo* block;
+  BlockInfo* next;
+  int bin;
+
+  if (myGeneration != cacheGeneration) {
+    return; // mm_init already threw it away
+  }
+  drainRemoteFrees(cache);
+  for (bin = 0; bin < CACHE_BINS; bin++) {
+    flushBin(cache, bin, cache->binCounts[bin]);
+  }
+  pthread_mutex_lock(&heapLock);
+  cache->inUse = 0;
+  block = __atomic_exchange_n(&cache->remoteFrees, REMOTE_CLOSED, __ATOMIC_ACQUIRE);
+  for (; block != NULL; block = next) {
+    next = block->next;
+    releaseBlock(block);
+  }
+  pthread_mutex_unlock(&heapLock);
+  myCache = NULL;
+}
+
+/* Around fork, hold every lock, so that the child does not inherit
+   one held by a thread it does not have. */
+static void lockAll(void) {
+  int c;
+
+  pthread_mutex_lock(&profileLock);
+  for (c = 0; c < SLAB_CLASSES; c++) {
+    pthread_mutex_lock(&slabLocks[c]);
+  }
+  pthread_mutex_lock(&unusedSlabLock);
+  pthread_mutex_lock(&heapLock);
+}
+
+static void unlockAll(void) {
+  int c;
+
+  pthread_mutex_unlock(&heapLock);
+  pthread_mutex_unlock(&unusedSlabLock);
+  for (c = 0; c < SLAB_CLASSES; c++) {
+    pthread_mutex_unlock(&slabLocks[c]);
+  }
+  pthread_mutex_unlock(&profileLock);
+}
+
+static void makeCacheKey(void) {
+  pthread_key_create(&cacheKey, releaseCache);
+  pthread_atfork(lockAll, unlockAll, unlockAll);
+}
+
+/* Return this thread's cache, claiming a free one on first use, or
+   NULL if every cache is taken. */
+static ThreadCache* getCache(void) {
+  int i;
+
+  if (myGeneration == cacheGeneration) {
+    return myCache;
+  }
+  myCache = NULL;
+  pthread_mutex_lock(&heapLock);
+  for (i = 0; i < MAX_THREADS; i++) {
+    if (!threadCaches[i].inUse) {
+      threadCaches[i].inUse = 1;
+      __atomic_store_n(&threadCaches[i].remoteFrees, NULL, __ATOMIC_RELAXED);
+      myCache = &threadCaches[i];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&heapLock);
+  myGeneration = cacheGeneration;
+  if (myCache != NULL) {
+    pthread_setspecific(cacheKey, myCache);
+  }
+  return myCache;
+}
+
+/* Take a used block of reqSize bytes from this thread's cache,
+   refilling the bin from the heap if it is empty.  Returns NULL if
+   the heap is out of room. */
+static BlockInfo* cachedAllocate(size_t reqSize) {
+  ThreadCache* cache = (reqSize <= CACHE_MAX_SIZE) ? getCache() : NULL;
+  BlockInfo* block;
+  BlockInfo* extra;
+  int bin, i;
+
+  if (cache != NULL) {
+    bin = CACHE_BIN(reqSize);
+    if (cache->bins[bin] == NULL) {
+      drainRemoteFrees(cache);
+    }
+    if ((block = cache->bins[bin]) != NULL) {
+      cache->bins[bin] = block->next;
+      cache->binCounts[bin]--;
+      return block;
+    }
+  }
+
+  pthread_mutex_lock(&heapLock);
+  block = allocateBlock(reqSize);
+  if (block == NULL) {
+    pthread_mutex_unlock(&heapLock);
+    return NULL;
+  }
+  OWNER(block, SIZE(block->sizeAndTags)) = cache;
+  // Take the rest of the batch while we hold the lock.  A block that
+  // came out too big to cache ends the batch.
+  for (i = 1; cache != NULL && i < CACHE_BATCH; i++) {
+    extra = allocateBlock(reqSize);
+    if (extra == NULL) {
+      break;
+    }
+    if (SIZE(extra->sizeAndTags) > CACHE_MAX_SIZE) {
+      releaseBlock(extra);
+      break;
+    }
+    OWNER(extra, SIZE(extra->sizeAndTags)) = cache;
+    bin = CACHE_BIN(SIZE(extra->sizeAndTags));
+    extra->next = cache->bins[bin];
+    cache->bins[bin] = extra;
+    cache->binCounts[bin]++;
+  }
+  pthread_mutex_unlock(&heapLock);
+  return block;
+}
+
+/* Free a used block: into this thread's cache if it owns the block,
+   onto the owner's remote list if another live thread does, and
+   otherwise straight back to the heap. */
+static void cachedRelease(BlockInfo* block) {
+  size_t blockSize = USED_SIZE(block);
+  ThreadCache* owner = OWNER(block, blockSize);
+
+  if (owner != NULL && blockSize <= CACHE_MAX_SIZE) {
+    if (owner == getCache()) {
+      cacheBlock(owner, block);
+      return;
+    }
+    if (__atomic_load_n(&owner->inUse, __ATOMIC_RELAXED) && pushRemoteFree(owner, block)) {
+      return;
+    }
+  }
+  pthread_mutex_lock(&heapLock);
+  releaseBlock(block);
+  pthread_mutex_unlock(&heapLock);
+}
+#endif
+
+/* Count calls to mm_malloc and mm_free (a batch counts as one call
+   per block).  Threads count in their own caches, so that they do not
+   fight over one cache line. */
+#ifdef MM_THREADSAFE
+static void countCalls(int isFree, size_t n) {
+  ThreadCache* cache = getCache();
+
+  if (cache == NULL) {
+    __atomic_fetch_add(isFree ? &uncachedFrees : &uncachedMallocs, n, __ATOMIC_RELAXED);
+  } else if (isFree) {
+    cache->numFrees += n;
+  } else {
+    cache->numMallocs += n;
+  }
+}
+#define COUNT_MALLOCS(n) countCalls(0, n)
+#define COUNT_FREES(n) countCalls(1, n)
+#else
+#define COUNT_MALLOCS(n) (PROLOGUE->numMallocs += (n))
+#define COUNT_FREES(n) (PROLOGUE->numFrees += (n))
+#endif
+#define COUNT_MALLOC() COUNT_MALLOCS(1)
+#define COUNT_FREE() COUNT_FREES(1)
+
+
+/******** PROFILING *************************************************/
+
+
+/* mm_profile_start turns on a sampling heap profiler.  About one in
+   every interval bytes handed out by mm_malloc and mm_calloc is
+   sampled: the gaps between sampled bytes are drawn from an
+   exponential distribution, so that every byte is equally likely to
+   be picked whatever the sizes of the requests, and a block is sampled
+   if a picked byte falls in it.  A sampled block's call stack and
+   size are added to the totals of its call site, and it is kept in a
+   table until mm_free sees it again, which adds its lifetime to the
+   site.  mm_profile_dump writes the totals in the text format of
+   gperftools' heap profiles (heap_v2), which pprof reads and scales
+   back up by the sampling interval.
+
+   While the profiler is off, mm_malloc and mm_free test only the
+   profiling flag.  While it is on, each thread counts down its bytes
+   until the next sample; mm_free takes the profile lock only if the
+   block's bucket in the sample table is not empty.  The profile lives
+   in a heap of its own (see HEAPS), which mm_profile_stop destroys. */
+#define PROFILE_INTERVAL_DEFAULT (512 * 1024)
+#define PROFILE_DEPTH 32        // frames kept per call stack
+#define PROFILE_SKIP 2          // profileAllocation and mm_malloc or mm_calloc
+#define SITE_BUCKETS 4096
+#define SAMPLE_BUCKETS 65536
+
+struct CallSite {
+  struct CallSite* next;        // in its bucket
+  void* stack[PROFILE_DEPTH];
+  int depth;
+  // Sampled blocks and their bytes: all of them, those not yet freed,
+  // and the lifetimes of those freed, in nanoseconds.
+  size_t allocs;
+  size_t allocBytes;
+  size_t liveBlocks;
+  size_t liveBytes;
+  size_t frees;
+  uint64_t lifetimeTotal;
+  uint64_t lifetimeMax;
+};
+typedef struct CallSite CallSite;
+
+struct Sample {
+  struct Sample* next;          // in its bucket
+  void* ptr;
+  size_t size;
+  uint64_t born;
+  CallSite* site;
+};
+typedef struct Sample Sample;
+
+struct Profile {
+  CallSite* sites[SITE_BUCKETS];
+};
+
+// Nonzero while the profiler is on.
+static int profiling;
+static size_t profileInterval;
+static struct mm_heap* profileHeap;
+static struct Profile* profile;
+// The sampled blocks, by address.  Not in profileHeap, so that
+// profileFree can look at a bucket without the lock even as the
+// profiler stops.
+static Sample* sampleTable[SAMPLE_BUCKETS];
+// Bumped by mm_profile_start, so that threads draw a new gap.
+static unsigned profileGeneration;
+static __thread ssize_t bytesUntilSample;
+static __thread unsigned sampleGeneration;
+static __thread uint64_t sampleSeed;
+// Set while the thread is in the profiler, whose own calls (say, the
+// C library allocating inside backtrace) are not profiled.
+static __thread int inProfiler;
+
+/* True while the profiler is on; otherwise one predictable branch. */
+#define PROFILING() __builtin_expect(__atomic_load_n(&profiling, __ATOMIC_RELAXED), 0)
+
+#define SAMPLE_BUCKET(ptr) ((((uintptr_t)(ptr)) >> 4) * 0x9E3779B97F4A7C15ull >> 48)
+
+static void lockProfile(void) {
+#ifdef MM_THREADSAFE
+  pthread_mutex_lock(&profileLock);
+#endif
+}
+
+static void unlockProfile(void) {
+#ifdef MM_THREADSAFE
+  pthread_mutex_unlock(&profileLock);
+#endif
+}
+
+/* The time in nanoseconds. */
+static uint64_t profileClock(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Draw the bytes until the next sample from the exponential
+   distribution with mean interval: -ln(u) * interval for u uniform in
+   (0, 1].  The logarithm is worked out here so as not to need libm. */
+static ssize_t sampleGap(size_t interval) {
+  uint64_t r;
+  int e;
+  double f, t, t2, lnU;
+
+  if (sampleSeed == 0) {
+    sampleSeed = ((uintptr_t)&sampleSeed ^ profileClock()) | 1;
+  }
+  sampleSeed ^= sampleSeed << 13;
+  sampleSeed ^= sampleSeed >> 7;
+  sampleSeed ^= sampleSeed << 17;
+  // u = r / 2^53, with r = 2^e (1 + f) and 0 <= f < 1.
+  r = (sampleSeed >> 11) + 1;
+  e = 63 - __builtin_clzll(r);
+  f = (double)r / (double)((uint64_t)1 << e) - 1.0;
+  t = f / (2.0 + f);
+  t2 = t * t;
+  lnU = (e - 53) * 0.69314718055994530942 +
+    2.0 * t * (1.0 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 / 7)));
+  return (ssize_t)(-lnU * interval) + 1;
+}
+
+/* The call site with the given stack, added if it is new.  Returns
+   NULL if the profile heap is full.  Called with the profile lock. */
+static CallSite* findCallSite(void** stack, int depth) {
+  uintptr_t hash = (uintptr_t)depth;
+  CallSite* site;
+  int i;
+
+  for (i = 0; i < depth; i++) {
+    hash = (hash + (uintptr_t)stack[i]) * 0x9E3779B97F4A7C15ull;
+  }
+  hash = (hash >> 32) % SITE_BUCKETS;
+  for (site = profile->sites[hash]; site != NULL; site = site->next) {
+    if (site->depth == depth && memcmp(site->stack, stack, depth * sizeof(void*)) == 0) {
+      return site;
+    }
+  }
+  site = mm_heap_malloc(profileHeap, sizeof(CallSite));
+  if (site != NULL) {
+    memset(site, 0, sizeof(CallSite));
+    memcpy(site->stack, stack, depth * sizeof(void*));
+    site->depth = depth;
+    site->next = profile->sites[hash];
+    profile->sites[hash] = site;
+  }
+  return site;
+}
+
+/* Take the sample of ptr off the table, if it has one, and count it
+   freed at time now.  Called with the profile lock. */
+static void forgetSample(void* ptr, uint64_t now) {
+  Sample** link = &sampleTable[SAMPLE_BUCKET(ptr)];
+  Sample* sample;
+  uint64_t lifetime;
+
+  for (; (sample = *link) != NULL; link = &sample->next) {
+    if (sample->ptr == ptr) {
+      lifetime = now - sample->born;
+      sample->site->liveBlocks--;
+      sample->site->liveBytes -= sample->size;
+      sample->site->frees++;
+      sample->site->lifetimeTotal += lifetime;
+      if (lifetime > sample->site->lifetimeMax) {
+        sample->site->lifetimeMax = lifetime;
+      }
+      // Unlinked with a store the lock-free test in profileFree can
+      // see at once.
+      __atomic_store_n(link, sample->next, __ATOMIC_RELAXED);
+      mm_heap_free(profileHeap, sample);
+      return;
+    }
+  }
+}
+
+/* Count size bytes allocated at ptr towards the next sample, and
+   sample the block if they reach it.  Not inlined, so that the stack
+   always starts with this and its caller. */
+static __attribute__((noinline)) void profileAllocation(void* ptr, size_t size) {
+  void* stack[PROFILE_DEPTH + PROFILE_SKIP];
+  unsigned generation = __atomic_load_n(&profileGeneration, __ATOMIC_RELAXED);
+  uint64_t now;
+  int depth;
+  Sample* sample;
+  CallSite* site;
+  Sample** bucket;
+
+  if (ptr == NULL || inProfiler) {
+    return;
+  }
+  if (sampleGeneration != generation) { // a new profile: draw a fresh gap
+    sampleGeneration = generation;
+    bytesUntilSample = sampleGap(__atomic_load_n(&profileInterval, __ATOMIC_RELAXED));
+  }
+  bytesUntilSample -= size;
+  if (bytesUntilSample > 0) {
+    return;
+  }
+
+  inProfiler = 1;
+  depth = backtrace(stack, PROFILE_DEPTH + PROFILE_SKIP) - PROFILE_SKIP;
+  now = profileClock();
+  lockProfile();
+  if (profile != NULL) {
+    bytesUntilSample = sampleGap(profileInterval);
+    // A block freed where mm_free did not see it leaves a stale sample.
+    forgetSample(ptr, now);
+    site = findCallSite(stack + PROFILE_SKIP, depth < 0 ? 0 : depth);
+    sample = (site == NULL) ? NULL : mm_heap_malloc(profileHeap, sizeof(Sample));
+    if (sample != NULL) {
+      site->allocs++;
+      site->allocBytes += size;
+      site->liveBlocks++;
+      site->liveBytes += size;
+      sample->ptr = ptr;
+      sample->size = size;
+      sample->born = now;
+      sample->site = site;
+      bucket = &sampleTable[SAMPLE_BUCKET(ptr)];
+      sample->next = *bucket;
+      __atomic_store_n(bucket, sample, __ATOMIC_RELEASE);
+    }
+  }
+  unlockProfile();
+  inProfiler = 0;
+}
+
+/* Note that the block at ptr is about to be freed. */
+static __attribute__((noinline)) void profileFree(void* ptr) {
+  // Most blocks were never sampled, and their buckets are empty.
+  if (inProfiler || __atomic_load_n(&sampleTable[SAMPLE_BUCKET(ptr)], __ATOMIC_RELAXED) == NULL) {
+    return;
+  }
+  inProfiler = 1;
+  lockProfile();
+  if (profile != NULL) {
+    forgetSample(ptr, profileClock());
+  }
+  unlockProfile();
+  inProfiler = 0;
+}
+
+/* Start sampling about one in every interval bytes allocated (a
+   default of 512 KB if 0), throwing away any earlier profile.
+   Returns -1 if there is no memory for the profile. */
+int mm_profile_start(size_t interval) {
+  struct Profile* fresh = NULL;
+  void* warm[1];
+
+  // backtrace may allocate on its first call; better now than with
+  // the profile lock held.
+  backtrace(warm, 1);
+  mm_profile_stop();
+  lockProfile();
+  profileHeap = mm_heap_create(0);
+  if (profileHeap != NULL) {
+    fresh = mm_heap_malloc(profileHeap, sizeof(struct Profile));
+  }
+  if (fresh == NULL) {
+    mm_heap_destroy(profileHeap);
+    profileHeap = NULL;
+    unlockProfile();
+    return -1;
+  }
+  memset(fresh, 0, sizeof(struct Profile));
+  __atomic_store_n(&profile, fresh, __ATOMIC_RELEASE);
+  __atomic_store_n(&profileInterval, (interval == 0) ? PROFILE_INTERVAL_DEFAULT : interval,
+                   __ATOMIC_RELAXED);
+  __atomic_fetch_add(&profileGeneration, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&profiling, 1, __ATOMIC_RELEASE);
+  unlockProfile();
+  return 0;
+}
+
+/* Stop sampling and throw the profile away. */
+void mm_profile_stop(void) {
+  lockProfile();
+  __atomic_store_n(&profiling, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&profile, NULL, __ATOMIC_RELEASE);
+  mm_heap_destroy(profileHeap);
+  profileHeap = NULL;
+  memset(sampleTable, 0, sizeof(sampleTable));
+  unlockProfile();
+}
+
+/* Write the profile to out, as pprof reads heap profiles: a line for
+   each call site, with its sampled blocks still in use and their
+   bytes, then all it has allocated, then its stack; and the mappings
+   of the process, for symbols.  A comment under each site gives the
+   lifetimes of its freed sampled blocks.  Returns -1 if the profiler
+   is off. */
+int mm_profile_dump(FILE* out) {
+  size_t liveBlocks = 0, liveBytes = 0, allocs = 0, allocBytes = 0;
+  CallSite* site;
+  FILE* maps;
+  char line[512];
+  int b, i;
+
+  inProfiler = 1;
+  lockProfile();
+  if (profile == NULL) {
+    unlockProfile();
+    inProfiler = 0;
+    return -1;
+  }
+  for (b = 0; b < SITE_BUCKETS; b++) {
+    for (site = profile->sites[b]; site != NULL; site = site->next) {
+      liveBlocks += site->liveBlocks;
+      liveBytes += site->liveBytes;
+      allocs += site->allocs;
+      allocBytes += site->allocBytes;
+    }
+  }
+  fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+          liveBlocks, liveBytes, allocs, allocBytes, profileInterval);
+  for (b = 0; b < SITE_BUCKETS; b++) {
+    for (site = profile->sites[b]; site != NULL; site = site->next) {
+      fprintf(out, "%zu: %zu [%zu: %zu] @", site->liveBlocks, site->liveBytes,
+              site->allocs, site->allocBytes);
+      for (i = 0; i < site->depth; i++) {
+        fprintf(out, " %p", site->stack[i]);
+      }
+      fprintf(out, "\n# lifetime: %zu freed, mean %.3f ms, max %.3f ms\n", site->frees,
+              site->frees ? site->lifetimeTotal / 1e6 / site->frees : 0.0,
+              site->lifetimeMax / 1e6);
+    }
+  }
+  unlockProfile();
+
+  fprintf(out, "\nMAPPED_LIBRARIES:\n");
+  maps = fopen("/proc/self/maps", "r");
+  if (maps != NULL) {
+    while (fgets(line, sizeof(line), maps) != NULL) {
+      fputs(line, out);
+    }
+    fclose(maps);
+  }
+  inProfiler = 0;
+  return 0;
+}
+
+/* The body of mm_malloc. */
+static inline void* allocate(size_t size) {
+  BlockInfo * blockInfo;
+
+  // Zero-size requests get NULL.
+  if (size == 0) {
+    return NULL;
+  }
+  COUNT_MALLOC();
+  if (size <= SLAB_MAX_SIZE && slabRegion != NULL) {
+    void* slot = slabAllocate(size);
+
+    if (slot != NULL) {
+      return slot;
+    }
+  }
+  if (size >= __atomic_load_n(&mmapThreshold, __ATOMIC_RELAXED)) {
+    void* mapped = mapBlock(size);
+
+    if (mapped != NULL) {
+      return mapped;
+    }
+  }
+
+#ifdef MM_THREADSAFE
+  blockInfo = cachedAllocate(blockSizeFor(size));
+#else
+  blockInfo = allocateBlock(blockSizeFor(size));
+#endif
+  if (blockInfo == NULL) {
+    return NULL;
+  }
+  return UNSCALED_POINTER_ADD(blockInfo, WORD_SIZE);
+}
+
+/* Allocate a block of size size and return a pointer to it. */
+void* mm_malloc (size_t size) {
+  void* ptr = allocate(size);
+
+  if (PROFILING()) {
+    profileAllocation(ptr, size);
+  }
+  return ptr;
+}
+
+/* Free the block referenced by ptr. */
+void mm_free (void *ptr) {
+  BlockInfo * blockInfo;
+
+  if (ptr == NULL) { // free(NULL) does nothing
+    return;
+  }
+  if (PROFILING()) {
+    profileFree(ptr);
+  }
+  COUNT_FREE();
+  if (IS_SLAB_SLOT(ptr)) {
+    slabFree(ptr);
+    return;
+  }
+
+  blockInfo = (BlockInfo*)UNSCALED_POINTER_SUB(ptr, WORD_SIZE);
+  if (IS_MAPPED(blockInfo)) {
+    unmapBlock(blockInfo);
+    return;
+  }
+#ifdef MM_THREADSAFE
+  cachedRelease(blockInfo);
+#else
+  releaseBlock(blockInfo);
+#endif
+}
+
+/* Allocate a block of size bytes whose payload is aligned to
+   alignment, a power of two, and return a pointer to it, or NULL if
+   alignment is not a power of two or there is no room.  Huge requests
+   get a mapping of their own; others are cut out of a larger heap
+   block. */
+void* mm_memalign(size_t alignment, size_t size) {
+  BlockInfo* blockInfo;
+
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+    return NULL;
+  }
+  if (alignment <= ALIGNMENT) {
+    return mm_malloc(size);
+  }
+  if (size == 0 || size > SIZE_MAX / 2 || alignment > SIZE_MAX / 4) {
+    return NULL;
+  }
+  COUNT_MALLOC();
+  if (size + alignment >= __atomic_load_n(&mmapThreshold, __ATOMIC_RELAXED)) {
+    void* mapped = mapAlignedBlock(alignment, size);
+
+    if (mapped != NULL) {
+      return mapped;
+    }
+  }
+  // The heap block is cut out of one alignment larger.
+  if (alignment > HEAP_MAX_REQUEST || size > HEAP_MAX_REQUEST - alignment) {
+    return NULL;
+  }
+
+#ifdef MM_THREADSAFE
+  {
+    ThreadCache* cache = getCache();
+
+    pthread_mutex_lock(&heapLock);
+    blockInfo = allocateAlignedBlock(alignment, blockSizeFor(size));
+    if (blockInfo != NULL) {
+      OWNER(blockInfo, SIZE(blockInfo->sizeAndTags)) = cache;
+    }
+    pthread_mutex_unlock(&heapLock);
+  }
+#else
+  blockInfo = allocateAlignedBlock(alignment, blockSizeFor(size));
+#endif
+  if (blockInfo == NULL) {
+    return NULL;
+  }
+  return UNSCALED_POINTER_ADD(blockInfo, WORD_SIZE);
+}
+
+/* C11's aligned_alloc: the same as mm_memalign. */
+void* mm_aligned_alloc(size_t alignment, size_t size) {
+  return mm_memalign(alignment, size);
+}
+
+/* Zeroed requests smaller than this are cleared in full: they may
+   come from a thread cache, and a page or less is quickly cleared. */
+#define CALLOC_LAZY_MIN 4096
+
+/* Allocate bytes zeroed bytes, at least CALLOC_LAZY_MIN, clearing
+   only what may not be zero. */
+static void* allocateZeroed(size_t bytes) {
+  BlockInfo* blockInfo;
+  char* payload;
+  char* fresh;
+
+  COUNT_MALLOC();
+  if (bytes >= __atomic_load_n(&mmapThreshold, __ATOMIC_RELAXED)) {
+    void* mapped = mapBlock(bytes);
+
+    if (mapped != NULL) {
+      return mapped;
+    }
+  }
+
+#ifdef MM_THREADSAFE
+  {
+    ThreadCache* cache = getCache();
+
+    pthread_mutex_lock(&heapLock);
+    fresh = PROLOGUE->freshFrom;
+    blockInfo = allocateBlock(blockSizeFor(bytes));
+    if (blockInfo != NULL) {
+      OWNER(blockInfo, SIZE(blockInfo->sizeAndTags)) = cache;
+    }
+    pthread_mutex_unlock(&heapLock);
+  }
+#else
+  fresh = PROLOGUE->freshFrom;
+  blockInfo = allocateBlock(blockSizeFor(bytes));
+#endif
+  if (blockInfo == NULL) {
+    return NULL;
+  }
+  payload = UNSCALED_POINTER_ADD(blockInfo, WORD_SIZE);
+  if (payload + bytes <= fresh) {
+    memset(payload, 0, bytes);
+    return payload;
+  }
+  if (payload < fresh) {
+    memset(payload, 0, fresh - payload);
+  }
+  // Above fresh, only its links and boundary tag from when it was
+  // free (in the thread-safe build, the owner word took the tag's
+  // place).
+  memset(payload, 0, 2 * WORD_SIZE);
+  if (OWNER_SIZE == 0) {
+    *(size_t*)UNSCALED_POINTER_ADD(blockInfo, SIZE(blockInfo->sizeAndTags) - WORD_SIZE) = 0;
+  }
+  return payload;
+}
+
+/* Allocate a block of nmemb * size bytes, all zero, and return a
+   pointer to it, or NULL if that is 0 bytes or overflows.
+
+   Memory from mem_sbrk and mmap starts out zero, and the heap above
+   freshFrom has held only free-block metadata since, so only the part
+   of a block below freshFrom, and what it held as a free block, is
+   cleared.  A large block carved from newly grown heap, or given a
+   mapping of its own, costs no more than one mm_malloc. */
+void* mm_calloc(size_t nmemb, size_t size) {
+  size_t bytes;
+  char* payload;
+
+  if (__builtin_mul_overflow(nmemb, size, &bytes) || bytes == 0) {
+    return NULL;
+  }
+  if (bytes < CALLOC_LAZY_MIN) {
+    payload = allocate(bytes);
+    if (payload != NULL) {
+      memset(payload, 0, bytes);
+    }
+  } else {
+    payload = allocateZeroed(bytes);
+  }
+  if (PROFILING()) {
+    profileAllocation(payload, bytes);
+  }
+  return payload;
+}
+
+/* Allocate n blocks of size bytes each, storing pointers to them in
+   ptrs, and return how many were allocated: n unless size is 0 or
+   memory runs out.  Small ones are taken from a slab, and the rest
+   cut out of as few free blocks as will hold them, taking the lock
+   once. */
+size_t mm_malloc_batch(size_t size, void** ptrs, size_t n) {
+  size_t done = 0;
+  size_t reqSize, carved;
+
+  if (size == 0 || n == 0) {
+    return 0;
+  }
+  if (size >= __atomic_load_n(&mmapThreshold, __ATOMIC_RELAXED)) {
+    while (done < n && (ptrs[done] = mm_malloc(size)) != NULL) {
+      done++;
+    }
+    return done;
+  }
+  COUNT_MALLOCS(n);
+  if (size <= SLAB_MAX_SIZE && slabRegion != NULL) {
+    done = slabAllocateBatch(size, ptrs, n);
+  }
+  if (done == n) {
+    return n;
+  }
+
+  reqSize = blockSizeFor(size);
+#ifdef MM_THREADSAFE
+  {
+    ThreadCache* cache = getCache();
+    BlockInfo* block;
+    size_t i = done;
+
+    pthread_mutex_lock(&heapLock);
+    while (done < n && (carved = carveBlocks(reqSize, ptrs + done, n - done)) != 0) {
+      done += carved;
+    }
+    for (; i < done; i++) {
+      block = (BlockInfo*)UNSCALED_POINTER_SUB(ptrs[i], WORD_SIZE);
+      OWNER(block, SIZE(block->sizeAndTags)) = cache;
+    }
+    pthread_mutex_unlock(&heapLock);
+  }
+#else
+  while (done < n && (carved = carveBlocks(reqSize, ptrs + done, n - done)) != 0) {
+    done += carved;
+  }
+#endif
+  return done;
+}
+
+static int compareAddresses(const void* a, const void* b) {
+  uintptr_t x = (uintptr_t)*(void* const*)a;
+  uintptr_t y = (uintptr_t)*(void* const*)b;
+
+  return (x > y) - (x < y);
+}
+
+/* Free the n blocks in ptrs (NULLs are skipped).  The heap blocks
+   among them are sorted by address, so that those next to each other
+   are merged and go back to the free lists as one, under one lock.
+   The array is used as scratch space and its contents are lost. */
+void mm_free_batch(void** ptrs, size_t n) {
+  size_t numHeap = 0;
+  size_t numFreed = 0;
+  size_t i, size;
+  BlockInfo* block;
+
+  if (PROFILING()) {
+    for (i = 0; i < n; i++) {
+      if (ptrs[i] != NULL) {
+        profileFree(ptrs[i]);
+      }
+    }
+  }
+  // Free the slab slots and mapped blocks, and gather the rest.
+  for (i = 0; i < n; i++) {
+    if (ptrs[i] == NULL) {
+      continue;
+    }
+    numFreed++;
+    if (IS_SLAB_SLOT(ptrs[i])) {
+      slabFree(ptrs[i]);
+    } else if (IS_MAPPED((BlockInfo*)UNSCALED_POINTER_SUB(ptrs[i], WORD_SIZE))) {
+      unmapBlock((BlockInfo*)UNSCALED_POINTER_SUB(ptrs[i], WORD_SIZE));
+    } else {
+      ptrs[numHeap++] = ptrs[i];
+    }
+  }
+  if (numFreed == 0) {
+    return;
+  }
+  COUNT_FREES(numFreed);
+  qsort(ptrs, numHeap, sizeof(void*), compareAddresses);
+
+#ifdef MM_THREADSAFE
+  pthread_mutex_lock(&heapLock);
+#endif
+  for (i = 0; i < numHeap; i++) {
+    block = (BlockInfo*)UNSCALED_POINTER_SUB(ptrs[i], WORD_SIZE);
+    size = SIZE(block->sizeAndTags);
+    // Take in the blocks that follow it in memory.
+    while (i + 1 < numHeap && ptrs[i + 1] == UNSCALED_POINTER_ADD(block, size + WORD_SIZE)) {
+      i++;
+      size += SIZE(((BlockInfo*)UNSCALED_POINTER_SUB(ptrs[i], WORD_SIZE))->sizeAndTags);
+    }
+    block->sizeAndTags = size | (block->sizeAndTags & TAG_PRECEDING_USED) | TAG_USED;
+    releaseBlock(block);
+  }
+#ifdef MM_THREADSAFE
+  pthread_mutex_unlock(&heapLock);
+#endif
+}
+
+/* Return the number of bytes the caller may use at ptr, a block
+   returned by mm_malloc: at least what was asked for. */
+size_t mm_usable_size(void* ptr) {
+  BlockInfo* blockInfo;
+
+  if (ptr == NULL) {
+    return 0;
+  }
+  if (IS_SLAB_SLOT(ptr)) {
+    return SLAB_OF(ptr)->slotSize;
+  }
+  blockInfo = (BlockInfo*)UNSCALED_POINTER_SUB(ptr, WORD_SIZE);
+  if (IS_MAPPED(blockInfo)) { // up to the end of the mapping
+    return (char*)MAP_START(blockInfo) + SIZE(blockInfo->sizeAndTags) - (char*)ptr;
+  }
+  return USED_SIZE(blockInfo) - WORD_SIZE - OWNER_SIZE;
+}
+
+
+// Implement a heap consistency checker as needed.
+int mm_check() {
+/* Print the heap by iterating through it as an implicit free list. */
+//  BlockInfo *block;
+
+/* print to stderr so output isn't buffered and not output if we crash */
+//  fprintf(stderr, "FREE_LIST_HEAD: %p\n", (void *)FREE_LIST_HEAD);
+
+//  for (block = (BlockInfo *)UNSCALED_POINTER_ADD(mem_heap_lo(), WORD_SIZE); /* first block on heap */
+//    SIZE(block->sizeAndTags) != 0 && block < mem_heap_hi();
+//    block = (BlockInfo *)UNSCALED_POINTER_ADD(block, SIZE(block->sizeAndTags))) {
+
+/* print out common block attributes */
 //    fprintf(stderr, "%p: %ld %ld %ld\t",
 //    (void *)block,
 //    SIZE(block->sizeAndTags),
@@ -470,8 +2576,479 @@ int mm_check() {
   return 0;
 }
 
-// Extra credit.
+/* Return the memory the allocator holds: the heap, the slabs handed
+   out so far, and the mapped blocks. */
+size_t mm_footprint(void) {
+  return heapSize() + (size_t)(slabTop - slabRegion) +
+    __atomic_load_n(&mappedBytes, __ATOMIC_RELAXED);
+}
+
+/* Fill in *stats.  Everything but the size of the largest free block
+   is kept up to date as the heap changes, so this is cheap; finding
+   the largest block walks one free list. */
+void mm_stats(struct mm_stats* stats) {
+  int c;
+  BlockInfo* block;
+
+  _Static_assert(FL_COUNT == MM_STATS_BUCKETS, "one histogram bucket per first-level class");
+#ifdef MM_THREADSAFE
+  pthread_mutex_lock(&heapLock);
+#endif
+#ifdef MM_QUICKLISTS
+  flushQuickLists();
+#endif
+  memset(stats, 0, sizeof(*stats));
+  stats->heapSize = heapSize();
+  stats->bytesFree = PROLOGUE->freeBytes;
+  stats->bytesInUse = stats->heapSize - PROLOGUE_SIZE - WORD_SIZE - stats->bytesFree;
+  for (c = 0; c < FL_COUNT; c++) {
+    stats->freeHistogram[c] = PROLOGUE->freeBlockCounts[c];
+    stats->freeBlocks += PROLOGUE->freeBlockCounts[c];
+  }
+
+  // The largest free block is on the highest non-empty list.
+  if (PROLOGUE->flBitmap != 0) {
+    c = 63 - __builtin_clzll(PROLOGUE->flBitmap);
+    c = (c << SL_SHIFT) | (31 - __builtin_clz(PROLOGUE->slBitmap[c]));
+    for (block = FREE_LIST_HEAD(c); block != NULL; block = block->next) {
+      if (SIZE(block->sizeAndTags) > stats->largestFreeBlock) {
+        stats->largestFreeBlock = SIZE(block->sizeAndTags);
+      }
+    }
+  }
+  // How much of the free space cannot be had in one piece.
+  stats->fragmentation = (stats->bytesFree == 0) ? 0.0 :
+    1.0 - (double)stats->largestFreeBlock / stats->bytesFree;
+
+#ifdef MM_THREADSAFE
+  stats->mallocs = __atomic_load_n(&uncachedMallocs, __ATOMIC_RELAXED);
+  stats->frees = __atomic_load_n(&uncachedFrees, __ATOMIC_RELAXED);
+  for (c = 0; c < MAX_THREADS; c++) {
+    stats->mallocs += threadCaches[c].numMallocs;
+    stats->frees += threadCaches[c].numFrees;
+  }
+#else
+  stats->mallocs = PROLOGUE->numMallocs;
+  stats->frees = PROLOGUE->numFrees;
+#endif
+  stats->coalesces = PROLOGUE->numCoalesces;
+#ifdef MM_THREADSAFE
+  pthread_mutex_unlock(&heapLock);
+#endif
+}
+
+/* Resize the used block blockInfo to reqSize bytes in place, if it
+   can be: it shrinks by freeing its tail and grows into a free block
+   following it, or, if it is the last block, by growing the heap.
+   Returns 0 if there is no room. */
+static int resizeBlock(BlockInfo* blockInfo, size_t reqSize) {
+  size_t blockSize = SIZE(blockInfo->sizeAndTags);
+  size_t available;
+  BlockInfo * followingBlock;
+
+  if (reqSize <= blockSize) { // shrinking: give back the tail
+    splitUsedBlock(blockInfo, reqSize);
+    return 1;
+  }
+
+  // Growing: how much is there if we take the following block too?
+  followingBlock = (BlockInfo*)UNSCALED_POINTER_ADD(blockInfo, blockSize);
+  available = blockSize;
+  if ((followingBlock->sizeAndTags & TAG_USED) == 0) {
+    available += SIZE(followingBlock->sizeAndTags);
+  }
+
+  // If nothing but free space follows us, the heap can grow under us.
+  if (available < reqSize &&
+      SIZE(((BlockInfo*)UNSCALED_POINTER_ADD(blockInfo, available))->sizeAndTags) == 0) {
+    followingBlock = requestMoreSpace(reqSize - blockSize);
+    if (followingBlock == NULL) {
+      return 0;
+    }
+    available = blockSize + SIZE(followingBlock->sizeAndTags);
+  }
+
+  if (available >= reqSize) { // absorb the following free block
+    removeFreeBlock(followingBlock);
+    blockInfo->sizeAndTags = available | (blockInfo->sizeAndTags & TAG_PRECEDING_USED) | TAG_USED;
+    followingBlock = (BlockInfo*)UNSCALED_POINTER_ADD(blockInfo, available);
+    followingBlock->sizeAndTags |= TAG_PRECEDING_USED;
+    splitUsedBlock(blockInfo, reqSize);
+    markWritten(blockInfo);
+    return 1;
+  }
+  return 0;
+}
+
+/* Resize the block referenced by ptr to hold size bytes, in place if
+   possible; otherwise the data is copied to a new block. */
 void* mm_realloc(void* ptr, size_t size) {
-  // ... implementation here ...
-  return NULL;
+  size_t blockSize;
+  int resized;
+  BlockInfo * blockInfo;
+  void * newPtr;
+
+  if (ptr == NULL) { // realloc(NULL, size) is malloc(size)
+    return mm_malloc(size);
+  }
+  if (size == 0) { // and realloc(ptr, 0) is free(ptr)
+    mm_free(ptr);
+    return NULL;
+  }
+  if (IS_SLAB_SLOT(ptr)) { // a slot keeps its size: move unless it fits
+    size_t slotSize = SLAB_OF(ptr)->slotSize;
+
+    if (size <= slotSize) {
+      return ptr;
+    }
+    newPtr = mm_malloc(size);
+    if (newPtr != NULL) {
+      memcpy(newPtr, ptr, slotSize);
+      mm_free(ptr);
+    }
+    return newPtr;
+  }
+
+  blockInfo = (BlockInfo*)UNSCALED_POINTER_SUB(ptr, WORD_SIZE);
+  if (IS_MAPPED(blockInfo)) { // stays mapped while it stays huge
+    size_t payloadSize = mm_usable_size(ptr);
+
+    if (size >= __atomic_load_n(&mmapThreshold, __ATOMIC_RELAXED) &&
+        (newPtr = remapBlock(blockInfo, size)) != NULL) {
+      return newPtr;
+    }
+    newPtr = mm_malloc(size);
+    if (newPtr != NULL) {
+      memcpy(newPtr, ptr, size < payloadSize ? size : payloadSize);
+      mm_free(ptr);
+    }
+    return newPtr;
+  }
+#ifdef MM_THREADSAFE
+  pthread_mutex_lock(&heapLock);
+  blockSize = SIZE(blockInfo->sizeAndTags);
+  {
+    ThreadCache* owner = OWNER(blockInfo, blockSize);
+
+    resized = resizeBlock(blockInfo, blockSizeFor(size));
+    if (resized) { // the owner word moves with the end of the block
+      OWNER(blockInfo, SIZE(blockInfo->sizeAndTags)) = owner;
+    }
+  }
+  pthread_mutex_unlock(&heapLock);
+#else
+  blockSize = SIZE(blockInfo->sizeAndTags);
+  resized = resizeBlock(blockInfo, blockSizeFor(size));
+#endif
+  if (resized) {
+    return ptr;
+  }
+
+  // No room here: move the data to a new block.
+  newPtr = mm_malloc(size);
+  if (newPtr != NULL) { // if not, ptr is left as it was
+    memcpy(newPtr, ptr, blockSize - WORD_SIZE - OWNER_SIZE);
+    mm_free(ptr);
+  }
+  return newPtr;
+}
+
+
+/******** ARENAS ****************************************************/
+
+
+/* An arena hands out memory by bumping a pointer through chunks it
+   gets from mm_malloc, and takes it all back at once: objects that
+   live and die together never go through mm_free one by one.
+
+   The chunks, all chunkSize bytes of space, stay linked in the order
+   they were first used.  Resetting the arena only moves it back to the
+   first of them, and they are filled again before any new chunk is
+   taken; so a reset takes constant time, apart from the objects too
+   large for a chunk, which get a block of their own and are freed.
+   An arena is not thread-safe: each thread should use its own. */
+#define ARENA_CHUNK_SIZE (64 * 1024 - 64)
+
+/* Requests larger than this part of a chunk get a block of their own,
+   so that they do not waste the rest of a chunk. */
+#define ARENA_LARGE_RATIO 4
+
+struct ArenaChunk {
+  // The chunk used after this one, or for large objects the next
+  // older one.
+  struct ArenaChunk* next;
+};
+typedef struct ArenaChunk ArenaChunk;
+
+/* Bytes before the space in a chunk, keeping it aligned. */
+#define ARENA_HEADER_SIZE ((sizeof(ArenaChunk) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+/* The space in a chunk. */
+#define CHUNK_SPACE(chunk) ((char*)(chunk) + ARENA_HEADER_SIZE)
+
+struct mm_arena {
+  ArenaChunk* first;      // NULL until the first allocation
+  ArenaChunk* current;    // chunk being filled, NULL if none yet
+  char* top;              // next free byte in current
+  char* end;              // end of current's space
+  size_t chunkSize;
+  ArenaChunk* large;      // large objects, newest first
+};
+
+/* Create an empty arena that gets chunkSize bytes at a time from the
+   heap (a default size if 0).  Returns NULL if out of memory. */
+struct mm_arena* mm_arena_create(size_t chunkSize) {
+  struct mm_arena* arena = mm_malloc(sizeof(struct mm_arena));
+
+  if (arena == NULL) {
+    return NULL;
+  }
+  if (chunkSize == 0) {
+    chunkSize = ARENA_CHUNK_SIZE;
+  }
+  arena->first = NULL;
+  arena->current = NULL;
+  arena->top = NULL;
+  arena->end = NULL;
+  arena->chunkSize = (chunkSize + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+  arena->large = NULL;
+  return arena;
+}
+
+/* The slow path of mm_arena_alloc: the current chunk cannot take an
+   aligned request of size bytes. */
+static void* arenaAllocateSlow(struct mm_arena* arena, size_t size) {
+  ArenaChunk* chunk;
+
+  if (size > arena->chunkSize / ARENA_LARGE_RATIO) {
+    chunk = mm_malloc(ARENA_HEADER_SIZE + size);
+    if (chunk == NULL) {
+      return NULL;
+    }
+    chunk->next = arena->large;
+    arena->large = chunk;
+    return CHUNK_SPACE(chunk);
+  }
+
+  // Move on to the next chunk, if a reset left one, else get one.
+  chunk = (arena->current != NULL) ? arena->current->next : arena->first;
+  if (chunk == NULL) {
+    chunk = mm_malloc(ARENA_HEADER_SIZE + arena->chunkSize);
+    if (chunk == NULL) {
+      return NULL;
+    }
+    chunk->next = NULL;
+    if (arena->current != NULL) {
+      arena->current->next = chunk;
+    } else {
+      arena->first = chunk;
+    }
+  }
+  arena->current = chunk;
+  arena->top = CHUNK_SPACE(chunk) + size;
+  arena->end = CHUNK_SPACE(chunk) + arena->chunkSize;
+  return CHUNK_SPACE(chunk);
+}
+
+/* Allocate size bytes from the arena, or return NULL if size is 0 or
+   the heap is out of memory. */
+void* mm_arena_alloc(struct mm_arena* arena, size_t size) {
+  void* ptr;
+
+  if (size - 1 >= SIZE_MAX / 2) { // 0, or absurdly large
+    return NULL;
+  }
+  size = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+  if (size > (size_t)(arena->end - arena->top)) {
+    return arenaAllocateSlow(arena, size);
+  }
+  ptr = arena->top;
+  arena->top += size;
+  return ptr;
+}
+
+/* Free the large objects allocated since the one at the head of
+   'large' was. */
+static void freeLargeSince(struct mm_arena* arena, ArenaChunk* large) {
+  ArenaChunk* chunk;
+
+  while (arena->large != large && arena->large != NULL) {
+    chunk = arena->large;
+    arena->large = chunk->next;
+    mm_free(chunk);
+  }
+}
+
+/* Free everything allocated from the arena, keeping its chunks for
+   what is allocated next. */
+void mm_arena_reset(struct mm_arena* arena) {
+  freeLargeSince(arena, NULL);
+  arena->current = NULL;
+  arena->top = NULL;
+  arena->end = NULL;
+}
+
+/* Record how far the arena has been filled, for mm_arena_rewind. */
+void mm_arena_mark(struct mm_arena* arena, struct mm_arena_mark* mark) {
+  mark->chunk = arena->current;
+  mark->top = arena->top;
+  mark->large = arena->large;
+}
+
+/* Free everything allocated from the arena since mark was recorded,
+   unless the arena has been reset since. */
+void mm_arena_rewind(struct mm_arena* arena, const struct mm_arena_mark* mark) {
+  freeLargeSince(arena, mark->large);
+  arena->current = mark->chunk;
+  arena->top = mark->top;
+  arena->end = (mark->chunk != NULL) ? CHUNK_SPACE(mark->chunk) + arena->chunkSize : NULL;
+}
+
+/* Free the arena and everything allocated from it. */
+void mm_arena_destroy(struct mm_arena* arena) {
+  ArenaChunk* chunk;
+
+  freeLargeSince(arena, NULL);
+  while (arena->first != NULL) {
+    chunk = arena->first;
+    arena->first = chunk->next;
+    mm_free(chunk);
+  }
+  mm_free(arena);
+}
+
+
+/******** HEAPS *****************************************************/
+
+
+/* A heap made by mm_heap_create is laid out and managed just like the
+   one mm_init sets up, with its own prologue and free lists, but in a
+   region it reserves with mmap; its struct mm_heap sits at the start
+   of the region, before the heap.  The block functions above work on
+   the heap that heap and heapLo point at, so each call below points
+   them at its heap and back again.  Its requests are not served from
+   slabs, mappings or the thread caches, so that everything it hands
+   out lies in the region and goes with it when it is destroyed.  In
+   the thread-safe build the heap lock is held meanwhile. */
+#define HEAP_RESERVE_DEFAULT ((size_t)1 << 30)
+
+/* Bytes before the heap in its region, keeping it aligned. */
+#define HEAP_HEADER_SIZE ((sizeof(struct mm_heap) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+/* Reserve size bytes of address space for a heap, a multiple of the
+   page size.  Returns NULL if it cannot be mapped. */
+static void* reserveRegion(size_t size) {
+#ifdef MM_HUGEPAGES
+  // A huge page more, cut off again around an aligned region.
+  size_t mapSize = size + HUGE_PAGE_SIZE;
+#else
+  size_t mapSize = size;
+#endif
+  // Only address space until the heap grows into it.
+  char* map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  char* start = map;
+
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+#ifdef MM_HUGEPAGES
+  start = (char*)(((uintptr_t)map + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+  if (start > map) {
+    munmap(map, start - map);
+  }
+  munmap(start + size, map + mapSize - (start + size));
+  madvise(start, size, MADV_HUGEPAGE);
+#endif
+  return start;
+}
+
+/* Work on h until leaveHeap. */
+static void enterHeap(struct mm_heap* h) {
+#ifdef MM_THREADSAFE
+  pthread_mutex_lock(&heapLock);
+#endif
+  heap = h;
+  heapLo = h->lo;
+}
+
+/* Go back to working on the memlib heap. */
+static void leaveHeap(void) {
+  heap = NULL;
+  heapLo = mem_heap_lo();
+#ifdef MM_THREADSAFE
+  pthread_mutex_unlock(&heapLock);
+#endif
+}
+
+/* Create an empty heap in a region of maxSize bytes (a default size
+   if 0).  Returns NULL if the region cannot be mapped. */
+struct mm_heap* mm_heap_create(size_t maxSize) {
+  size_t pagesize = mem_pagesize();
+  struct mm_heap* h;
+  int failed;
+
+  if (maxSize == 0) {
+    maxSize = HEAP_RESERVE_DEFAULT;
+  }
+  if (maxSize > SIZE_MAX - HEAP_HEADER_SIZE - pagesize) {
+    return NULL;
+  }
+#ifdef MM_HUGEPAGES
+  // The heap must be able to grow to a huge page boundary.
+  pagesize = HUGE_PAGE_SIZE;
+#endif
+  maxSize = (maxSize + HEAP_HEADER_SIZE + pagesize - 1) / pagesize * pagesize;
+  h = reserveRegion(maxSize);
+  if (h == NULL) {
+    return NULL;
+  }
+  h->lo = (char*)h + HEAP_HEADER_SIZE;
+  h->brk = h->lo;
+  h->max = (char*)h + maxSize;
+
+  enterHeap(h);
+  failed = initHeap();
+  leaveHeap();
+  if (failed) {
+    munmap(h, maxSize);
+    return NULL;
+  }
+  return h;
+}
+
+/* Allocate a block of size bytes from heap h, or return NULL if it
+   does not fit in what is left of h's region. */
+void* mm_heap_malloc(struct mm_heap* h, size_t size) {
+  BlockInfo* blockInfo;
+
+  if (size == 0 || size > HEAP_MAX_REQUEST || size >= (size_t)(h->max - h->lo)) {
+    return NULL;
+  }
+  enterHeap(h);
+  blockInfo = allocateBlock(blockSizeFor(size));
+  leaveHeap();
+  if (blockInfo == NULL) {
+    return NULL;
+  }
+  return UNSCALED_POINTER_ADD(blockInfo, WORD_SIZE);
+}
+
+/* Free the block referenced by ptr, which came from heap h. */
+void mm_heap_free(struct mm_heap* h, void* ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  enterHeap(h);
+  releaseBlock((BlockInfo*)UNSCALED_POINTER_SUB(ptr, WORD_SIZE));
+  leaveHeap();
+}
+
+/* Give heap h's region back to the system, and with it every block
+   still allocated from it. */
+void mm_heap_destroy(struct mm_heap* h) {
+  if (h == NULL) {
+    return;
+  }
+  munmap(h, (size_t)(h->max - (char*)h));
 }
@@ -0,0 +1,123 @@
+#include <stdio.h>
+
+extern int mm_init (void);
+extern void *mm_malloc (size_t size);
+extern void mm_free (void *ptr);
+extern void *mm_realloc(void *ptr, size_t size);
+extern int mm_check(void);
+
+/* Allocate size bytes aligned to alignment, a power of two.  The
+   block may be passed to mm_free and mm_realloc like any other (but
+   mm_realloc only keeps the usual alignment). */
+extern void *mm_memalign(size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+
+/* Allocate nmemb * size zeroed bytes.  Fresh heap and mapped memory is
+   already zero and is not cleared again. */
+extern void *mm_calloc(size_t nmemb, size_t size);
+
+/* Allocate n blocks of size bytes into ptrs, and return how many were
+   allocated (n unless size is 0 or memory runs out).  Much cheaper
+   per block than n calls to mm_malloc. */
+extern size_t mm_malloc_batch(size_t size, void **ptrs, size_t n);
+
+/* Free the n blocks in ptrs, skipping NULLs.  Overwrites ptrs. */
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/* Bytes usable at ptr, a block from mm_malloc; at least as many as
+   were asked for. */
+extern size_t mm_usable_size(void *ptr);
+
+/* Requests of at least threshold bytes get their own mapping.  By
+   default the threshold adapts to the program; setting it fixes it. */
+extern void mm_set_mmap_threshold(size_t threshold);
+
+/* Give free heap memory back to the system, keeping at most pad bytes
+   free at the end of the heap.  Returns 1 if any memory was released. */
+extern int mm_trim(size_t pad);
+
+/* How many times the heap has been extended, and by how many bytes
+   more in total than the requests that triggered it needed. */
+struct mm_growth_stats {
+  size_t extensions;
+  size_t bytesOverReserved;
+};
+extern void mm_get_growth_stats(struct mm_growth_stats *stats);
+
+/* A snapshot of the heap.  Sizes are in bytes and count the heap
+   only, not small requests served from slabs or huge ones served by
+   their own mappings.  freeHistogram[i] counts the free blocks of
+   2^(i+5) up to 2^(i+6) bytes; the last bucket also counts all larger
+   ones. */
+#define MM_STATS_BUCKETS 40
+
+struct mm_stats {
+  size_t heapSize;
+  size_t bytesInUse;
+  size_t bytesFree;
+  size_t freeBlocks;
+  size_t largestFreeBlock;
+  size_t freeHistogram[MM_STATS_BUCKETS];
+  /* 1 - largestFreeBlock / bytesFree: the share of free memory that
+     cannot be had in one piece. */
+  double fragmentation;
+  size_t mallocs;
+  size_t frees;
+  size_t coalesces;
+};
+extern void mm_stats(struct mm_stats *stats);
+
+/* Bytes of memory the allocator holds: the heap, plus the slabs and
+   mappings it serves small and huge requests from. */
+extern size_t mm_footprint(void);
+
+/* Arenas: many small objects allocated by bumping a pointer through
+   large blocks from mm_malloc, and freed all at once by
+   mm_arena_reset, which takes constant time, or mm_arena_destroy.
+   mm_arena_rewind frees just what was allocated since mm_arena_mark.
+   An arena must only be used by one thread at a time. */
+struct mm_arena;
+
+struct mm_arena_mark {
+  void *chunk;
+  char *top;
+  void *large;
+};
+
+extern struct mm_arena *mm_arena_create(size_t chunkSize);
+extern void *mm_arena_alloc(struct mm_arena *arena, size_t size);
+extern void mm_arena_reset(struct mm_arena *arena);
+extern void mm_arena_mark(struct mm_arena *arena, struct mm_arena_mark *mark);
+extern void mm_arena_rewind(struct mm_arena *arena, const struct mm_arena_mark *mark);
+extern void mm_arena_destroy(struct mm_arena *arena);
+
+/* Heaps: each has a region and free lists of its own, apart from the
+   heap mm_malloc uses.  Blocks from mm_heap_malloc must be freed with
+   mm_heap_free on the same heap, or not at all: mm_heap_destroy gives
+   the whole region back at once.  maxSize bounds how large the heap
+   can grow (0 for a default of 1 GB); it is only address space until
+   used, and mm_heap_malloc returns NULL once it is full.  In the
+   thread-safe build, calls on any heap take the lock that guards
+   mm_malloc's heap. */
+struct mm_heap;
+
+extern struct mm_heap *mm_heap_create(size_t maxSize);
+extern void *mm_heap_malloc(struct mm_heap *heap, size_t size);
+extern void mm_heap_free(struct mm_heap *heap, void *ptr);
+extern void mm_heap_destroy(struct mm_heap *heap);
+
+/* Sampling heap profiler.  mm_profile_start samples about one in
+   every interval bytes that mm_malloc and mm_calloc hand out (a
+   default of 512 KB if 0), recording the call stack, size and, once
+   freed, lifetime of each sampled block.  mm_profile_dump writes the
+   per-call-site totals as a heap profile that pprof can read:
+       pprof --text ./program profile.heap
+   Blocks from the batch, aligned and heap-instance functions are not
+   sampled, and a block resized in place by mm_realloc keeps the size
+   it was sampled at.  When the profiler is off it costs mm_malloc and
+   mm_free one branch each.  mm_profile_start returns -1 if there is
+   no memory for the profile, and mm_profile_dump -1 if the profiler
+   is off; otherwise they return 0. */
+extern int mm_profile_start(size_t interval);
+extern void mm_profile_stop(void);
+extern int mm_profile_dump(FILE *out);
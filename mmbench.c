@@ -0,0 +1,863 @@
+/*
+ * mmbench.c - trace-driven benchmark for the mm.c allocator
+ *
+ * Replays allocation traces against mm.c and against the system
+ * malloc, side by side, and reports for each allocator and trace:
+ *
+ *   Mops/s   operations per second, over the whole trace
+ *   util     peak live payload bytes / peak memory footprint
+ *   p99      99th percentile latency of a single operation
+ *
+ * The footprint of mm.c is what mm_footprint() reports; that of the
+ * system malloc is its arena plus its mapped chunks, as mallinfo2()
+ * reports them, sampled every FOOT_EVERY operations.
+ *
+ * A trace is a sequence of operations on numbered blocks, in the
+ * format of the malloc lab's trace files:
+ *
+ *     <suggested heap size>     (ignored)
+ *     <number of ids>
+ *     <number of operations>
+ *     <weight>                  (ignored)
+ *     a <id> <bytes>            allocate
+ *     r <id> <bytes>            reallocate
+ *     f <id>                    free
+ *
+ * Traces are read from files, or generated: see the generators below.
+ * With no traces named, every generator is run.
+ *
+ * Build:  gcc -O2 -o mmbench mmbench.c mm.c memlib.c
+ *
+ * Usage: mmbench [-hv] [-n ops] [-r reps] [-s seed] [-w dir]
+ *                [-g generator]... [tracefile]...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <malloc.h>
+#include <sys/mman.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+/* Misc constants */
+#define MAXTRACES 64	/* most traces on one command line */
+#define MAXNAME 64	/* longest trace name */
+#define FOOT_EVERY 64	/* system malloc footprint sampling interval */
+#define ALIGN 8		/* alignment every allocator must give */
+
+/* One operation of a trace */
+typedef struct {
+    char type;		/* 'a', 'r' or 'f' */
+    int id;		/* block it works on */
+    size_t size;	/* bytes, for 'a' and 'r' */
+} traceop_t;
+
+/* A trace, and the state of a generator building one */
+typedef struct {
+    char name[MAXNAME];
+    int num_ids;
+    int num_ops;
+    int max_ops;	/* room in ops */
+    int max_ids;	/* room in live */
+    traceop_t *ops;
+    char *live;		/* while generating: is block id allocated? */
+} trace_t;
+
+/* An allocator under test */
+typedef struct {
+    const char *name;
+    int (*init)(void);
+    void *(*malloc)(size_t);
+    void (*free)(void *);
+    void *(*realloc)(void *, size_t);
+    size_t (*footprint)(void);
+    int foot_every;	/* footprint sampling interval */
+} allocator_t;
+
+/* The results of running one trace */
+typedef struct {
+    double mops;	/* millions of operations per second */
+    double util;	/* peak live bytes / peak footprint */
+    double p99;		/* 99th percentile op latency, ns */
+} result_t;
+
+/* Global variables */
+static int verbose = 0;		/* if true, print extra output */
+static unsigned long seed = 1;	/* state of the random number generator */
+
+/* Function prototypes */
+static void usage(void);
+static void app_error(char *msg);
+static void *xmap(size_t size);
+static void xunmap(void *p, size_t size);
+static unsigned long rnd(void);
+static size_t rnd_size(size_t lo, size_t hi);
+
+static trace_t *new_trace(const char *name);
+static void free_trace(trace_t *t);
+static void add_op(trace_t *t, char type, int id, size_t size);
+static int t_alloc(trace_t *t, size_t size);
+static void t_realloc(trace_t *t, int id, size_t size);
+static void t_free(trace_t *t, int id);
+static void t_finish(trace_t *t);
+static trace_t *read_trace(const char *path);
+static void write_trace(trace_t *t, const char *dir);
+
+static void gen_binary_tree(trace_t *t, int nops);
+static void gen_sliding_window(trace_t *t, int nops);
+static void gen_producer_consumer(trace_t *t, int nops);
+static void gen_realloc_growth(trace_t *t, int nops);
+static void gen_bimodal(trace_t *t, int nops);
+static void gen_alternating(trace_t *t, int nops);
+
+static double now_ns(void);
+static void mark_block(int i, char *p, size_t size);
+static void check_block(trace_t *t, int i, char *p, size_t size);
+static double eval_util(allocator_t *a, trace_t *t);
+static double eval_speed(allocator_t *a, trace_t *t, int reps);
+static double eval_p99(allocator_t *a, trace_t *t);
+
+static int mm_reset(void);
+static void print_mm_stats(void);
+static int libc_init(void);
+static size_t libc_footprint(void);
+
+/* The generators, by name */
+static struct {
+    const char *name;
+    void (*gen)(trace_t *, int);
+} generators[] = {
+    { "binary-tree",       gen_binary_tree },
+    { "sliding-window",    gen_sliding_window },
+    { "producer-consumer", gen_producer_consumer },
+    { "realloc-growth",    gen_realloc_growth },
+    { "bimodal",           gen_bimodal },
+    { "alternating",       gen_alternating },
+};
+#define NGEN (int)(sizeof(generators) / sizeof(generators[0]))
+
+/* The allocators, compared side by side */
+static allocator_t allocators[] = {
+    { "mm.c", mm_reset, mm_malloc, mm_free, mm_realloc, mm_footprint, 1 },
+    { "libc", libc_init, malloc, free, realloc, libc_footprint, FOOT_EVERY },
+};
+#define NALLOC (int)(sizeof(allocators) / sizeof(allocators[0]))
+
+/*
+ * main - The benchmark's main routine
+ */
+int main(int argc, char **argv)
+{
+    trace_t *traces[MAXTRACES];
+    int ntraces = 0;
+    int nops = 200000;
+    int reps = 3;
+    char *dir = NULL;
+    result_t r;
+    int c, i, j;
+
+    while ((c = getopt(argc, argv, "hvn:r:s:w:g:")) != EOF) {
+	switch (c) {
+	case 'h':
+	    usage();
+	    break;
+	case 'v':
+	    verbose = 1;
+	    break;
+	case 'n':
+	    nops = atoi(optarg);
+	    break;
+	case 'r':
+	    reps = atoi(optarg);
+	    break;
+	case 's':
+	    seed = strtoul(optarg, NULL, 10);
+	    break;
+	case 'w':
+	    dir = optarg;
+	    break;
+	case 'g':
+	    for (i = 0; i < NGEN; i++)
+		if (strcmp(optarg, generators[i].name) == 0)
+		    break;
+	    if (i == NGEN)
+		usage();
+	    if (ntraces == MAXTRACES)
+		app_error("too many traces");
+	    traces[ntraces] = new_trace(generators[i].name);
+	    generators[i].gen(traces[ntraces], nops);
+	    t_finish(traces[ntraces++]);
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (nops <= 0 || reps <= 0 || seed == 0)
+	usage();
+    for (; optind < argc; optind++) {
+	if (ntraces == MAXTRACES)
+	    app_error("too many traces");
+	traces[ntraces++] = read_trace(argv[optind]);
+    }
+    if (ntraces == 0) {
+	for (i = 0; i < NGEN; i++) {
+	    traces[ntraces] = new_trace(generators[i].name);
+	    generators[i].gen(traces[ntraces], nops);
+	    t_finish(traces[ntraces++]);
+	}
+    }
+
+    mem_init();
+    printf("%-18s %-5s %9s %8s %8s %7s\n",
+	   "trace", "alloc", "ops", "Mops/s", "util", "p99 ns");
+    for (i = 0; i < ntraces; i++) {
+	if (dir != NULL)
+	    write_trace(traces[i], dir);
+	if (verbose)
+	    printf("%s: %d ids, %d ops\n", traces[i]->name,
+		   traces[i]->num_ids, traces[i]->num_ops);
+	for (j = 0; j < NALLOC; j++) {
+	    r.util = eval_util(&allocators[j], traces[i]);
+	    if (verbose && j == 0)
+		print_mm_stats();
+	    r.mops = eval_speed(&allocators[j], traces[i], reps);
+	    r.p99 = eval_p99(&allocators[j], traces[i]);
+	    printf("%-18s %-5s %9d %8.2f %7.1f%% %7.0f\n",
+		   j == 0 ? traces[i]->name : "", allocators[j].name,
+		   traces[i]->num_ops, r.mops, 100 * r.util, r.p99);
+	}
+	free_trace(traces[i]);
+    }
+    mem_deinit();
+    exit(0);
+}
+
+/*****************
+ * Trace building
+ *****************/
+
+/*
+ * new_trace - return an empty trace
+ */
+static trace_t *new_trace(const char *name)
+{
+    trace_t *t = xmap(sizeof(trace_t));
+
+    snprintf(t->name, MAXNAME, "%s", name);
+    return t;
+}
+
+/*
+ * free_trace - free a trace and its operations
+ */
+static void free_trace(trace_t *t)
+{
+    xunmap(t->ops, t->max_ops * sizeof(traceop_t));
+    xunmap(t->live, t->max_ids);
+    xunmap(t, sizeof(trace_t));
+}
+
+/*
+ * add_op - append an operation to a trace
+ */
+static void add_op(trace_t *t, char type, int id, size_t size)
+{
+    traceop_t *ops;
+
+    if (t->num_ops == t->max_ops) {
+	ops = xmap(2 * (t->max_ops + 1024) * sizeof(traceop_t));
+	if (t->ops != NULL) {
+	    memcpy(ops, t->ops, t->num_ops * sizeof(traceop_t));
+	    xunmap(t->ops, t->max_ops * sizeof(traceop_t));
+	}
+	t->ops = ops;
+	t->max_ops = 2 * (t->max_ops + 1024);
+    }
+    t->ops[t->num_ops].type = type;
+    t->ops[t->num_ops].id = id;
+    t->ops[t->num_ops].size = size;
+    t->num_ops++;
+}
+
+/*
+ * t_alloc - append an allocation of a new block and return its id
+ */
+static int t_alloc(trace_t *t, size_t size)
+{
+    char *live;
+
+    if (t->num_ids == t->max_ids) {
+	live = xmap(2 * (t->max_ids + 1024));
+	if (t->live != NULL) {
+	    memcpy(live, t->live, t->num_ids);
+	    xunmap(t->live, t->max_ids);
+	}
+	t->live = live;
+	t->max_ids = 2 * (t->max_ids + 1024);
+    }
+    t->live[t->num_ids] = 1;
+    add_op(t, 'a', t->num_ids, size);
+    return t->num_ids++;
+}
+
+/*
+ * t_realloc - append a reallocation of block id
+ */
+static void t_realloc(trace_t *t, int id, size_t size)
+{
+    add_op(t, 'r', id, size);
+}
+
+/*
+ * t_free - append a free of block id
+ */
+static void t_free(trace_t *t, int id)
+{
+    t->live[id] = 0;
+    add_op(t, 'f', id, 0);
+}
+
+/*
+ * t_finish - free every block the generator left allocated, so that
+ *    every trace ends with an empty heap
+ */
+static void t_finish(trace_t *t)
+{
+    int id;
+
+    for (id = 0; id < t->num_ids; id++)
+	if (t->live[id])
+	    t_free(t, id);
+}
+
+/*
+ * read_trace - read a trace file
+ */
+static trace_t *read_trace(const char *path)
+{
+    FILE *fp;
+    trace_t *t;
+    const char *base = strrchr(path, '/');
+    char type[2];
+    int id, num_ids, num_ops, i;
+    long heap, weight;
+    size_t size;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	perror(path);
+	exit(1);
+    }
+    t = new_trace(base != NULL ? base + 1 : path);
+    if (fscanf(fp, "%ld %d %d %ld", &heap, &num_ids, &num_ops, &weight) != 4)
+	app_error("bad trace header");
+    for (i = 0; i < num_ops; i++) {
+	size = 0;
+	if (fscanf(fp, "%1s %d", type, &id) != 2 ||
+	    (type[0] != 'f' && fscanf(fp, "%zu", &size) != 1) ||
+	    strchr("arf", type[0]) == NULL || id < 0 || id >= num_ids)
+	    app_error("bad trace operation");
+	add_op(t, type[0], id, size);
+    }
+    t->num_ids = num_ids;
+    fclose(fp);
+    return t;
+}
+
+/*
+ * write_trace - save a trace, as <dir>/<name>.rep
+ */
+static void write_trace(trace_t *t, const char *dir)
+{
+    char path[1024];
+    FILE *fp;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/%s.rep", dir, t->name);
+    if ((fp = fopen(path, "w")) == NULL) {
+	perror(path);
+	exit(1);
+    }
+    fprintf(fp, "0\n%d\n%d\n1\n", t->num_ids, t->num_ops);
+    for (i = 0; i < t->num_ops; i++) {
+	if (t->ops[i].type == 'f')
+	    fprintf(fp, "f %d\n", t->ops[i].id);
+	else
+	    fprintf(fp, "%c %d %zu\n", t->ops[i].type, t->ops[i].id,
+		    t->ops[i].size);
+    }
+    fclose(fp);
+}
+
+/*************
+ * Generators
+ *************/
+
+/*
+ * tree - allocate a complete binary tree of the given depth in
+ *    preorder, leaving the ids of its nodes in heap order in ids[]
+ */
+static void tree(trace_t *t, int *ids, int i, int n)
+{
+    if (i >= n)
+	return;
+    ids[i] = t_alloc(t, rnd_size(24, 64));
+    tree(t, ids, 2 * i + 1, n);
+    tree(t, ids, 2 * i + 2, n);
+}
+
+/*
+ * untree - free a tree built by tree, in postorder
+ */
+static void untree(trace_t *t, int *ids, int i, int n)
+{
+    if (i >= n)
+	return;
+    untree(t, ids, 2 * i + 1, n);
+    untree(t, ids, 2 * i + 2, n);
+    t_free(t, ids[i]);
+}
+
+/*
+ * gen_binary_tree - build and tear down trees of small nodes of random
+ *    depth while one long-lived tree stays allocated, as a program
+ *    building syntax trees or a GC benchmark does
+ */
+static void gen_binary_tree(trace_t *t, int nops)
+{
+    int ids[1 << 14];
+    int n;
+
+    tree(t, ids, 0, (1 << 12) - 1);		/* the long-lived tree */
+    while (t->num_ops < nops) {
+	n = (1 << (4 + rnd() % 10)) - 1;
+	tree(t, ids + (1 << 12), 0, n);
+	untree(t, ids + (1 << 12), 0, n);
+    }
+}
+
+/*
+ * gen_sliding_window - each new block frees the one allocated W blocks
+ *    before it, as a cache of recent items does
+ */
+static void gen_sliding_window(trace_t *t, int nops)
+{
+    int window[1024];
+    int w = 512 + rnd() % 512;
+    int i;
+
+    for (i = 0; t->num_ops < nops; i = (i + 1) % w) {
+	if (t->num_ids >= w)
+	    t_free(t, window[i]);
+	window[i] = t_alloc(t, rnd_size(16, 4096));
+    }
+}
+
+/*
+ * gen_producer_consumer - messages are allocated in bursts and freed in
+ *    bursts, oldest first, so the queue between them keeps changing
+ *    length
+ */
+static void gen_producer_consumer(trace_t *t, int nops)
+{
+    static int queue[1 << 16];
+    int head = 0, tail = 0;
+    int n;
+
+    while (t->num_ops < nops) {
+	for (n = 1 + rnd() % 64; n > 0 && tail - head < (1 << 16); n--)
+	    queue[tail++ % (1 << 16)] = t_alloc(t, rnd_size(64, 2048));
+	for (n = 1 + rnd() % 60; n > 0 && head < tail; n--)
+	    t_free(t, queue[head++ % (1 << 16)]);
+    }
+}
+
+/*
+ * gen_realloc_growth - buffers grow by half again at a time up to a
+ *    random limit, the way dynamic arrays and string builders do,
+ *    among short-lived small allocations
+ */
+static void gen_realloc_growth(trace_t *t, int nops)
+{
+    int buf[64], small[256];
+    size_t size[64], limit[64];
+    int i;
+
+    for (i = 0; i < 64; i++)
+	buf[i] = -1;
+    for (i = 0; i < 256; i++)
+	small[i] = t_alloc(t, rnd_size(16, 128));
+    while (t->num_ops < nops) {
+	i = rnd() % 64;
+	if (buf[i] < 0) {
+	    size[i] = 16;
+	    limit[i] = rnd_size(4096, 1 << 20);
+	    buf[i] = t_alloc(t, size[i]);
+	} else if (size[i] < limit[i]) {
+	    size[i] += size[i] / 2;
+	    t_realloc(t, buf[i], size[i]);
+	} else {
+	    t_free(t, buf[i]);
+	    buf[i] = -1;
+	}
+	i = rnd() % 256;
+	t_free(t, small[i]);
+	small[i] = t_alloc(t, rnd_size(16, 128));
+    }
+}
+
+/*
+ * gen_bimodal - a random live set of mostly tiny blocks, and some large
+ *    ones
+ */
+static void gen_bimodal(trace_t *t, int nops)
+{
+    static int slot[4096];
+    int i;
+
+    for (i = 0; i < 4096; i++)
+	slot[i] = -1;
+    while (t->num_ops < nops) {
+	i = rnd() % 4096;
+	if (slot[i] >= 0) {
+	    t_free(t, slot[i]);
+	    slot[i] = -1;
+	} else if (rnd() % 10 != 0) {
+	    slot[i] = t_alloc(t, rnd_size(8, 64));
+	} else {
+	    slot[i] = t_alloc(t, rnd_size(16 << 10, 256 << 10));
+	}
+    }
+}
+
+/*
+ * gen_alternating - a few neighbouring small blocks at a time are freed
+ *    and then allocated again at the same sizes, so that an allocator
+ *    that merges freed blocks at once splits them straight back up
+ */
+static void gen_alternating(trace_t *t, int nops)
+{
+    static int slot[4096];
+    static size_t size[4096];
+    size_t sizes[4];
+    int i, j, n;
+
+    for (j = 0; j < 4; j++)
+	sizes[j] = rnd_size(72, 512);
+    for (i = 0; i < 4096; i++) {
+	size[i] = sizes[rnd() % 4];
+	slot[i] = t_alloc(t, size[i]);
+    }
+    while (t->num_ops < nops) {
+	i = rnd() % 4096;
+	n = 1 + rnd() % 8;
+	for (j = 0; j < n; j++)
+	    t_free(t, slot[(i + j) % 4096]);
+	for (j = 0; j < n; j++)
+	    slot[(i + j) % 4096] = t_alloc(t, size[(i + j) % 4096]);
+    }
+}
+
+/*************
+ * Evaluation
+ *************/
+
+/*
+ * mm_reset - start mm.c over on an empty heap
+ */
+static int mm_reset(void)
+{
+    mem_reset_brk();
+    return mm_init();
+}
+
+/*
+ * print_mm_stats - describe what a run did to mm.c's heap
+ */
+static void print_mm_stats(void)
+{
+    struct mm_stats st;
+    struct mm_growth_stats gs;
+
+    mm_stats(&st);
+    mm_get_growth_stats(&gs);
+    printf("  mm.c: %zu mallocs, %zu frees, %zu coalesces, "
+	   "%zu heap extensions (%zu bytes over-reserved)\n",
+	   st.mallocs, st.frees, st.coalesces, gs.extensions,
+	   gs.bytesOverReserved);
+    printf("  mm.c: heap %zu bytes, %zu free in %zu blocks, "
+	   "fragmentation %.2f\n", st.heapSize, st.bytesFree, st.freeBlocks,
+	   st.fragmentation);
+}
+
+/*
+ * libc_init - give back what the system malloc kept from the last run,
+ *    so that each run starts from as clean a heap as mm.c's
+ */
+static int libc_init(void)
+{
+    malloc_trim(0);
+    return 0;
+}
+
+/*
+ * libc_footprint - memory the system malloc holds
+ */
+static size_t libc_footprint(void)
+{
+    struct mallinfo2 mi = mallinfo2();
+
+    return mi.arena + mi.hblkhd;
+}
+
+/*
+ * now_ns - a monotonic clock, in nanoseconds
+ */
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * mark_block - write a pattern for block i into its first and last
+ *    bytes
+ */
+static void mark_block(int i, char *p, size_t size)
+{
+    if (size > 1)
+	p[size - 1] = (char)(i >> 8);
+    if (size > 0)
+	p[0] = (char)i;
+}
+
+/*
+ * check_block - check that block i of size bytes at p is aligned and
+ *    still holds the pattern mark_block wrote
+ */
+static void check_block(trace_t *t, int i, char *p, size_t size)
+{
+    char msg[128];
+
+    if ((uintptr_t)p % ALIGN != 0 ||
+	(size > 0 && p[0] != (char)i) ||
+	(size > 1 && p[size - 1] != (char)(i >> 8))) {
+	snprintf(msg, sizeof(msg), "%s: block %d corrupted or misaligned",
+		 t->name, i);
+	app_error(msg);
+    }
+}
+
+/*
+ * eval_util - replay a trace, checking each block, and return peak
+ *    live bytes over peak footprint
+ */
+static double eval_util(allocator_t *a, trace_t *t)
+{
+    char **block = xmap(t->num_ids * sizeof(char *));
+    size_t *size = xmap(t->num_ids * sizeof(size_t));
+    size_t live = 0, peak_live = 0, foot, peak_foot = 0;
+    traceop_t *op;
+    char *p;
+    int i;
+
+    if (a->init() < 0)
+	app_error("init failed");
+    for (i = 0; i < t->num_ops; i++) {
+	op = &t->ops[i];
+	p = NULL;
+	switch (op->type) {
+	case 'a':
+	    if ((p = a->malloc(op->size)) == NULL)
+		app_error("malloc failed");
+	    block[op->id] = p;
+	    size[op->id] = op->size;
+	    live += op->size;
+	    break;
+	case 'r':
+	    check_block(t, op->id, block[op->id], size[op->id]);
+	    if ((p = a->realloc(block[op->id], op->size)) == NULL)
+		app_error("realloc failed");
+	    if (op->size > 0 && size[op->id] > 0 && p[0] != (char)op->id)
+		app_error("realloc lost the data");
+	    block[op->id] = p;
+	    live += op->size - size[op->id];
+	    size[op->id] = op->size;
+	    break;
+	case 'f':
+	    check_block(t, op->id, block[op->id], size[op->id]);
+	    a->free(block[op->id]);
+	    live -= size[op->id];
+	    block[op->id] = NULL;
+	    continue;
+	}
+	mark_block(op->id, p, size[op->id]);
+	if (live > peak_live)
+	    peak_live = live;
+	if (i % a->foot_every == 0 && (foot = a->footprint()) > peak_foot)
+	    peak_foot = foot;
+    }
+    xunmap(block, t->num_ids * sizeof(char *));
+    xunmap(size, t->num_ids * sizeof(size_t));
+    return peak_foot == 0 ? 0 : (double)peak_live / peak_foot;
+}
+
+/*
+ * replay - replay a trace without checks, timing each operation into
+ *    lat[] if it is not NULL
+ */
+static void replay(allocator_t *a, trace_t *t, void **block, double *lat)
+{
+    traceop_t *op;
+    double start = 0;
+    int i;
+
+    if (a->init() < 0)
+	app_error("init failed");
+    for (i = 0; i < t->num_ops; i++) {
+	op = &t->ops[i];
+	if (lat != NULL)
+	    start = now_ns();
+	switch (op->type) {
+	case 'a':
+	    block[op->id] = a->malloc(op->size);
+	    break;
+	case 'r':
+	    block[op->id] = a->realloc(block[op->id], op->size);
+	    break;
+	case 'f':
+	    a->free(block[op->id]);
+	    break;
+	}
+	if (lat != NULL)
+	    lat[i] = now_ns() - start;
+    }
+}
+
+/*
+ * eval_speed - return the best of reps replays, in Mops/s
+ */
+static double eval_speed(allocator_t *a, trace_t *t, int reps)
+{
+    void **block = xmap(t->num_ids * sizeof(void *));
+    double start, best = 0;
+
+    while (reps-- > 0) {
+	start = now_ns();
+	replay(a, t, block, NULL);
+	if (best == 0 || now_ns() - start < best)
+	    best = now_ns() - start;
+    }
+    xunmap(block, t->num_ids * sizeof(void *));
+    return t->num_ops / best * 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * eval_p99 - return the 99th percentile latency of one operation, in
+ *    nanoseconds
+ */
+static double eval_p99(allocator_t *a, trace_t *t)
+{
+    void **block = xmap(t->num_ids * sizeof(void *));
+    double *lat = xmap(t->num_ops * sizeof(double));
+    double p99;
+
+    replay(a, t, block, lat);
+    qsort(lat, t->num_ops, sizeof(double), cmp_double);
+    p99 = lat[(int)(t->num_ops * 0.99)];
+    xunmap(block, t->num_ids * sizeof(void *));
+    xunmap(lat, t->num_ops * sizeof(double));
+    return p99;
+}
+
+/*******************
+ * Helper routines
+ *******************/
+
+/*
+ * xmap - memory for the benchmark itself, mapped directly so that it
+ *    counts against neither allocator's footprint
+ */
+static void *xmap(size_t size)
+{
+    void *p = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED)
+	app_error("mmap failed");
+    return p;
+}
+
+static void xunmap(void *p, size_t size)
+{
+    if (p != NULL)
+	munmap(p, size ? size : 1);
+}
+
+/*
+ * rnd - xorshift random number generator
+ */
+static unsigned long rnd(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+/*
+ * rnd_size - a size from lo to hi bytes, uniform in its logarithm so
+ *    that small sizes are as common as in real programs
+ */
+static size_t rnd_size(size_t lo, size_t hi)
+{
+    size_t top = lo;
+
+    while (top < hi && rnd() % 2)
+	top = top * 2 < hi ? top * 2 : hi;
+    return top / 2 >= lo ? top / 2 + rnd() % (top - top / 2 + 1)
+			 : lo + rnd() % (top - lo + 1);
+}
+
+/*
+ * usage - print a help message
+ */
+static void usage(void)
+{
+    int i;
+
+    printf("Usage: mmbench [-hv] [-n ops] [-r reps] [-s seed] [-w dir] "
+	   "[-g generator]... [tracefile]...\n");
+    printf("   -h   print this message\n");
+    printf("   -v   print additional diagnostic information\n");
+    printf("   -n   operations per generated trace (default 200000)\n");
+    printf("   -r   timed replays per trace; the best counts (default 3)\n");
+    printf("   -s   random seed, nonzero (default 1)\n");
+    printf("   -w   also write each trace to <dir>/<name>.rep\n");
+    printf("   -g   generate a trace; generators:");
+    for (i = 0; i < NGEN; i++)
+	printf(" %s", generators[i].name);
+    printf("\n");
+    exit(1);
+}
+
+/*
+ * app_error - application-style error routine
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
@@ -0,0 +1,228 @@
+/*
+ * mmpreload.c - mm.c as the C library's malloc, for LD_PRELOAD
+ *
+ * Exports malloc, free, calloc, realloc and the aligned and size
+ * query functions on top of mm.c, so that the allocator can be
+ * measured under real programs rather than traces:
+ *
+ *     gcc -O2 -shared -fPIC -ftls-model=initial-exec -DMM_THREADSAFE \
+ *         -DMM_ALIGNMENT=16 -pthread -o libmm.so mmpreload.c mm.c memlib.c
+ *     LD_PRELOAD=./libmm.so ./tsh
+ *
+ * The heap lives in the region memlib reserves with mmap.  It is set
+ * up on the first call.  Setting up may itself allocate (the thread
+ * library does, as does dlsym), so calls made by the thread doing it
+ * are served from a small static arena instead; its blocks are never
+ * reused.  The initial-exec TLS model keeps thread-local variables,
+ * here and in mm.c, from being allocated on first use.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+#ifndef MM_THREADSAFE
+#error "mmpreload.c needs the thread-safe allocator: build with -DMM_THREADSAFE"
+#endif
+
+#define BOOT_SIZE (64 * 1024)   /* bytes in the startup arena */
+#define BOOT_ALIGN 16           /* alignment of startup blocks */
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static int ready;                       /* set once mm_init has run */
+static __thread int initializing;       /* set in the thread running it */
+
+static char boot_arena[BOOT_SIZE] __attribute__((aligned(BOOT_ALIGN)));
+static size_t boot_used;
+
+/*
+ * init - set up memlib and the allocator, once
+ */
+static void init(void)
+{
+    initializing = 1;
+    mem_init();
+    mm_init();
+    initializing = 0;
+    __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * boot_alloc - carve size bytes out of the startup arena, or return
+ *     NULL if it is used up.  Each block is preceded by its size.
+ */
+static void *boot_alloc(size_t size)
+{
+    size_t need = BOOT_ALIGN + (size + BOOT_ALIGN - 1) / BOOT_ALIGN * BOOT_ALIGN;
+    char *p;
+
+    if (size > BOOT_SIZE || need > BOOT_SIZE - boot_used)
+	return NULL;
+    p = boot_arena + boot_used;
+    boot_used += need;
+    *(size_t *)p = size;
+    return p + BOOT_ALIGN;
+}
+
+#define IS_BOOT(p) \
+    ((char *)(p) >= boot_arena && (char *)(p) < boot_arena + BOOT_SIZE)
+
+#define BOOT_BLOCK_SIZE(p) (*(size_t *)((char *)(p) - BOOT_ALIGN))
+
+/*
+ * start - make sure the allocator is set up.  Returns 0 if the caller
+ *     is the thread setting it up and must use the startup arena.
+ */
+static inline int start(void)
+{
+    if (__builtin_expect(__atomic_load_n(&ready, __ATOMIC_ACQUIRE), 1))
+	return 1;
+    if (initializing)
+	return 0;
+    pthread_once(&init_once, init);
+    return 1;
+}
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (!start())
+	return boot_alloc(size);
+    p = mm_malloc(size ? size : 1);
+    if (p == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || IS_BOOT(ptr))
+	return;
+    mm_free(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    size_t bytes;
+    void *p;
+
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (!start())
+	return boot_alloc(bytes);       /* the arena starts out zero */
+    p = mm_calloc(bytes ? bytes : 1, 1);
+    if (p == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (IS_BOOT(ptr)) {                 /* move it out of the arena */
+	p = malloc(size);
+	if (p != NULL)
+	    memcpy(p, ptr, size < BOOT_BLOCK_SIZE(ptr) ? size : BOOT_BLOCK_SIZE(ptr));
+	return p;
+    }
+    if (size == 0) {
+	mm_free(ptr);
+	return NULL;
+    }
+    p = mm_realloc(ptr, size);
+    if (p == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    size_t bytes;
+
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    return realloc(ptr, bytes);
+}
+
+/*
+ * aligned - the aligned allocators share this; alignment is a power
+ *     of two
+ */
+static void *aligned(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (!start()) {
+	if (alignment > BOOT_ALIGN)
+	    return NULL;
+	return boot_alloc(size);
+    }
+    p = mm_memalign(alignment, size ? size : 1);
+    if (p == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+	return EINVAL;
+    p = aligned(alignment, size);
+    if (p == NULL)
+	return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+    return aligned(alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    /* Like glibc, round a bad alignment up to a power of two. */
+    if (alignment & (alignment - 1))
+	alignment = (size_t)1 << (64 - __builtin_clzll(alignment));
+    return aligned(alignment ? alignment : 1, size);
+}
+
+void *valloc(size_t size)
+{
+    return aligned(mem_pagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+
+    return aligned(pagesize, (size + pagesize - 1) / pagesize * pagesize);
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    if (ptr == NULL)
+	return 0;
+    if (IS_BOOT(ptr))
+	return BOOT_BLOCK_SIZE(ptr);
+    return mm_usable_size(ptr);
+}
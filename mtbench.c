@@ -0,0 +1,128 @@
+/*
+ * mtbench.c - multi-threaded throughput benchmark for mm.c
+ *
+ * Each thread allocates and frees small blocks of random sizes, keeping
+ * up to SLOTS of them live at a time.  One operation in REMOTE_EVERY
+ * instead swaps a block through a shared mailbox, so that blocks are
+ * regularly freed by a thread other than the one that allocated them.
+ * The run is repeated with 1, 2, 4, ... threads up to the given
+ * maximum and reports total operations per second for each.
+ *
+ * Build against the thread-safe allocator:
+ *
+ *     gcc -O2 -DMM_THREADSAFE -pthread -o mtbench mtbench.c mm.c memlib.c
+ *
+ * Usage: mtbench [maxthreads [ops per thread]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+#define SLOTS 1024        /* live blocks per thread */
+#define MAILBOXES 256     /* shared slots for cross-thread frees */
+#define REMOTE_EVERY 8    /* one op in this many goes through a mailbox */
+#define MAXSIZE 256       /* largest request */
+
+static long opsPerThread = 1000000;
+static void *mailbox[MAILBOXES];
+
+/*
+ * xorshift - small per-thread random number generator
+ */
+static unsigned xorshift(unsigned *state)
+{
+    unsigned x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/*
+ * worker - the body of each benchmark thread
+ */
+static void *worker(void *arg)
+{
+    unsigned seed = (unsigned)(size_t)arg * 2654435761u + 1;
+    void *slot[SLOTS];
+    void *p;
+    long op;
+    int i;
+
+    memset(slot, 0, sizeof(slot));
+    for (op = 0; op < opsPerThread; op++) {
+        i = xorshift(&seed) % SLOTS;
+        if (slot[i] == NULL) {
+            slot[i] = mm_malloc(1 + xorshift(&seed) % MAXSIZE);
+            *(char *)slot[i] = (char)op;    /* touch it */
+        } else if (xorshift(&seed) % REMOTE_EVERY == 0) {
+            /* Trade our block for whatever some other thread left. */
+            p = __atomic_exchange_n(&mailbox[xorshift(&seed) % MAILBOXES],
+                                    slot[i], __ATOMIC_ACQ_REL);
+            slot[i] = NULL;
+            mm_free(p);
+        } else {
+            mm_free(slot[i]);
+            slot[i] = NULL;
+        }
+    }
+    for (i = 0; i < SLOTS; i++)
+        mm_free(slot[i]);
+    return NULL;
+}
+
+/*
+ * run - time opsPerThread operations on each of nthreads threads
+ */
+static double run(int nthreads)
+{
+    pthread_t *tid = malloc(nthreads * sizeof(pthread_t));
+    struct timespec start, end;
+    int i;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+    memset(mailbox, 0, sizeof(mailbox));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&tid[i], NULL, worker, (void *)(size_t)i);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tid[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (i = 0; i < MAILBOXES; i++)
+        mm_free(mailbox[i]);
+    free(tid);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    int maxthreads = argc > 1 ? atoi(argv[1]) : 8;
+    int n;
+    double secs, base = 0;
+
+    if (argc > 2)
+        opsPerThread = atol(argv[2]);
+    mem_init();
+
+    printf("%8s %12s %10s %8s\n", "threads", "ops/sec", "seconds", "speedup");
+    for (n = 1; n <= maxthreads; n *= 2) {
+        secs = run(n);
+        if (n == 1)
+            base = opsPerThread / secs;
+        printf("%8d %12.0f %10.3f %8.2f\n", n, n * opsPerThread / secs, secs,
+               n * opsPerThread / secs / base);
+    }
+    return 0;
+}
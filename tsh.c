@@ -4,6 +4,7 @@
  * Jordan Andrade
  * Partner: Shawn Colby
  */
+#define _GNU_SOURCE       /* splice, tee, copy_file_range, pipe2 */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -14,12 +15,28 @@
 #include <sys/wait.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
 
 /* Misc manifest constants */
 #define MAXLINE    1024   /* max line size */
 #define MAXARGS     128   /* max args on a command line */
 #define MAXJOBS      16   /* max jobs at any point in time */
 #define MAXJID    1<<16   /* max job ID */
+#define MAXDONE      64   /* finished background jobs remembered for wait */
+#define LCHUNK  (1<<16)   /* per-line storage chunk size */
+#define DIRBUF  (1<<16)   /* getdents64 buffer size */
+#define DCBUCKETS    64   /* directory cache hash buckets */
+#define VARBUCKETS  256   /* variable table hash buckets */
+#define PCHUNK     4096   /* parse pool chunk size */
+#define MAXDEPTH   1000   /* max function call depth */
+#define MAXLOCALS  1024   /* max saved variables of local */
+#define XFERMAX (1<<30)   /* most bytes asked of the kernel per copy call */
+#define COPYBUF (1<<20)   /* cat/tee buffer when the kernel can't copy */
+#define PIPEBUF (1<<20)   /* pipe size asked for by cat and tee */
 
 /* Job states */
 #define UNDEF 0 /* undefined */
@@ -51,324 +68,3820 @@ struct job_t {              /* The job struct */
     char cmdline[MAXLINE];  /* command line */
 };
 struct job_t jobs[MAXJOBS]; /* The job list */
+
+struct done_t {             /* a finished background job */
+    pid_t pid;
+    int jid;
+    int status;             /* as in $? */
+    int reported;           /* already returned by wait */
+};
+struct done_t done[MAXDONE]; /* ring of the last MAXDONE of them */
+unsigned ndone;             /* how many have finished in all */
+int last_status;            /* exit status of the last command ($?) */
+pid_t fgreaped;             /* last foreground job the reaper saw end or stop */
+int fgreapedstatus;         /* and its status, as in $? */
+pid_t lastbg;               /* PID of the last background job ($!) */
+
+struct argvec {             /* growable, NULL-terminated argument vector */
+    char **v;
+    int n;
+    int cap;
+};
+struct argvec xargv;        /* expanded argv of the current command */
+
+struct strbuf {             /* growable string */
+    char *s;
+    size_t len;
+    size_t cap;
+};
+
+struct posargs {            /* positional parameters $1, $2, ... */
+    int n;
+    char **v;
+};
+struct posargs pos;
+
+/* Tokens returned by lex() */
+#define T_EOF     0
+#define T_WORD    1
+#define T_NEWLINE 2
+#define T_SEMI    3   /* ; */
+#define T_DSEMI   4   /* ;; */
+#define T_AMP     5   /* & */
+#define T_AND     6   /* && */
+#define T_OR      7   /* || */
+#define T_LPAREN  8   /* ( */
+#define T_RPAREN  9   /* ) */
+
+/* Command tree node types */
+#define N_CMD    0    /* simple command: words */
+#define N_AND    1    /* left && right */
+#define N_OR     2    /* left || right */
+#define N_NOT    3    /* ! left */
+#define N_GROUP  4    /* { left } */
+#define N_IF     5    /* if left then right else elsep */
+#define N_WHILE  6    /* while left do right */
+#define N_UNTIL  7    /* until left do right */
+#define N_FOR    8    /* for var in words do right */
+#define N_CASE   9    /* case word in left (a chain of N_ITEM) */
+#define N_ITEM  10    /* words) right ;; */
+#define N_FUNC  11    /* var () left */
+
+struct node {               /* a command tree node */
+    int type;
+    int bg;                 /* followed by & */
+    struct node *next;      /* next command of a list */
+    struct node *left;
+    struct node *right;
+    struct node *elsep;
+    char **words;           /* raw, unexpanded words */
+    char *word;
+    struct var *var;
+    struct pool *pool;      /* N_FUNC: the pool holding the body */
+    char *text;             /* source text, for the job list */
+};
+
+struct pool {               /* storage of one parsed command text */
+    int refs;               /* eval, plus functions defined in it */
+    struct lchunk *chunks;
+};
+
+struct parser {
+    const char *p;          /* where lex() continues */
+    int tok;                /* current token */
+    const char *start;      /* and its text */
+    const char *end;
+    const char *prevend;    /* end of the previous token */
+    int more;               /* the text ended too early */
+    int err;                /* a syntax error was reported */
+    struct pool *pool;
+};
+
+struct local {              /* a variable saved by local */
+    struct var *var;
+    struct value *val;
+    int exported;
+};
+struct local locals[MAXLOCALS];
+int nlocals;
+
+volatile sig_atomic_t interrupted; /* ctrl-c stops loops too */
+int loopdepth;              /* loops being run */
+int funcdepth;              /* functions being run */
+int breakn;                 /* loops still to leave for break n */
+int contn;                  /* loops still to leave for continue n */
+int funcret;                /* return was run */
 /* End global variables */
 
 
-/* Function prototypes */
+/* Function prototypes */
+
+/* Here are the functions that you will implement */
+int eval(char *cmdline);
+int builtin_cmd(char **argv);
+void do_bgfg(char **argv);
+int waitfg(pid_t pid);
+void do_wait(char **argv);
+
+void sigchld_handler(int sig);
+void sigtstp_handler(int sig);
+void sigint_handler(int sig);
+
+/* Here are helper routines that we've provided for you */
+int parse(const char *text, struct pool *pool, struct node **prog);
+void droppool(struct pool *pool);
+int exec_list(struct node *n);
+void exec_node(struct node *n);
+void exec_cmd(struct node *cmd);
+pid_t forkjob(char ***segs, int nseg, int bg, char *cmdline, int closefd);
+int redirect(char **argv, int *save);
+void unredirect(int *save);
+int splitpipe(char **argv, char ***segs);
+void run_pipeline(char ***segs, int nseg, char **envp);
+int iscopier(const char *name);
+void copypipe(char ***segs, int nseg, char *cmdline);
+void do_cat(char **argv);
+void do_tee(char **argv);
+void callfunc(struct var *fn, char **argv);
+void setpositional(int n, char **argv);
+struct var *getfunc(const char *name);
+int do_script(char **argv);
+char **expandargs(char **argv, int assignok);
+int applyassigns(int export);
+void expand_done(void);
+void initvars(void);
+char **buildenv(void);
+void do_export(char **argv);
+void do_unset(char **argv);
+void do_local(char **argv);
+void sbput(struct strbuf *sb, const char *s, size_t n);
+void sigquit_handler(int sig);
+
+void clearjob(struct job_t *job);
+void initjobs(struct job_t *jobs);
+int maxjid(struct job_t *jobs); 
+int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline);
+int deletejob(struct job_t *jobs, pid_t pid); 
+pid_t fgpid(struct job_t *jobs);
+struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
+struct job_t *getjobjid(struct job_t *jobs, int jid); 
+int pid2jid(pid_t pid); 
+void listjobs(struct job_t *jobs);
+
+void usage(void);
+void unix_error(char *msg);
+void app_error(char *msg);
+typedef void handler_t(int);
+handler_t *Signal(int signum, handler_t *handler);
+
+/*
+ * main - The shell's main routine 
+ */
+int main(int argc, char **argv) 
+{
+    char c;
+    char cmdline[MAXLINE];
+    struct strbuf text = { NULL, 0, 0 }; /* command text read so far */
+    int emit_prompt = 1; /* emit prompt (default) */
+    int more = 0;        /* text is incomplete, read another line */
+    FILE *in = stdin;
+
+    /* Redirect stderr to stdout (so that driver will get all output
+     * on the pipe connected to stdout) */
+    dup2(1, 2);
+
+    /* Parse the command line */
+    while ((c = getopt(argc, argv, "+hvp")) != EOF) {
+        switch (c) {
+        case 'h':             /* print help message */
+            usage();
+	    break;
+        case 'v':             /* emit additional diagnostic info */
+            verbose = 1;
+	    break;
+        case 'p':             /* don't print a prompt */
+            emit_prompt = 0;  /* handy for automatic testing */
+	    break;
+	default:
+            usage();
+	}
+    }
+
+    /* A script file to run instead of stdin, and its arguments */
+    if (optind < argc) {
+	if ((in = fopen(argv[optind], "r")) == NULL) {
+	    printf("%s: %s\n", argv[optind], strerror(errno));
+	    exit(127);
+	}
+	emit_prompt = 0;
+	setpositional(argc - optind - 1, argv + optind + 1);
+    }
+
+    /* Install the signal handlers */
+
+    /* These are the ones you will need to implement */
+    Signal(SIGINT,  sigint_handler);   /* ctrl-c */
+    Signal(SIGTSTP, sigtstp_handler);  /* ctrl-z */
+    Signal(SIGCHLD, sigchld_handler);  /* Terminated or stopped child */
+
+    /* This one provides a clean way to kill the shell */
+    Signal(SIGQUIT, sigquit_handler); 
+
+    /* Initialize the job list */
+    initjobs(jobs);
+
+    /* Import the environment into the variable store */
+    initvars();
+
+    /* Execute the shell's read/eval loop */
+    while (1) {
+
+	/* Read command line */
+	if (emit_prompt) {
+	    printf("%s", more ? "> " : prompt);
+	    fflush(stdout);
+	}
+	if (fgets(cmdline, MAXLINE, in) == NULL) {
+	    if (ferror(in))
+		app_error("fgets error");
+	    /* End of file (ctrl-d) */
+	    if (more) {
+		printf("syntax error: unexpected end of file\n");
+		last_status = 2;
+	    }
+	    fflush(stdout);
+	    exit(last_status);
+	}
+	sbput(&text, cmdline, strlen(cmdline));
+	if (text.s[text.len-1] != '\n') {
+	    if (!feof(in))
+		continue;     /* the rest of a long line */
+	    sbput(&text, "\n", 1);
+	}
+
+	/* Evaluate the command text */
+	more = eval(text.s);
+	if (!more)
+	    text.len = 0;
+	fflush(stdout);
+    } 
+
+    exit(0); /* control never reaches here */
+}
+  
+/*
+ * eval - Evaluate the command text that the user has just typed in
+ *
+ * The text is parsed once into a command tree, which exec_list()
+ * then runs.  Returns true if the text is not complete yet (an open
+ * quote, or an if, while, ... without its closing keyword): the
+ * caller should read another line and call eval again with both.
+ */
+int eval(char *cmdline) 
+{
+    struct pool *pool;
+    struct node *prog;
+    int r;
+
+    if ((pool = calloc(1, sizeof(struct pool))) == NULL)
+	unix_error("eval error");
+    pool->refs = 1;
+
+    r = parse(cmdline, pool, &prog);
+    if (r == 0) {
+	interrupted = 0;
+	exec_list(prog);
+    }
+    else if (r < 0) {
+	last_status = 2;
+    }
+    droppool(pool);
+    return r > 0;
+}
+
+/* 
+ * exec_cmd - Run a simple command or a pipeline
+ * 
+ * If the user has requested a built-in command (quit, jobs, bg or fg)
+ * then execute it immediately. Otherwise, fork a child process and
+ * run the job in the context of the child. If the job is running in
+ * the foreground, wait for it to terminate and then return.  Note:
+ * each child process must have a unique process group ID so that our
+ * background children don't receive SIGINT (SIGTSTP) from the kernel
+ * when we type ctrl-c (ctrl-z) at the keyboard.  
+*/
+void exec_cmd(struct node *cmd) 
+{
+        char **rawargv = cmd->words; // raw words, as parsed
+        int bg = cmd->bg; // followed by &
+	char *cmdline = cmd->text; // text shown by jobs
+	char **argv;
+	char **segs[MAXARGS]; // the commands of a pipeline
+	int nseg;
+	int save[3]; // descriptors replaced by redirections
+	struct var *fn;
+    	pid_t pid;
+
+	argv = expandargs(rawargv, 1); // expand variables and wildcards, remove quotes
+	if(argv == NULL) { // a substitution failed
+		last_status = 1;
+		expand_done();
+		return;
+	}
+
+	if(argv[0] == NULL) { // only assignments on the line
+		applyassigns(0);
+		last_status = 0;
+		expand_done();
+		return;
+	}
+
+	if((nseg = splitpipe(argv, segs)) == 0) { // | at the start or end, or ||
+		printf("syntax error near '|'\n");
+		last_status = 2;
+		expand_done();
+		return;
+	}
+
+	if(nseg > 1) { // a pipeline
+		if(!bg && (iscopier(segs[0][0]) || iscopier(segs[nseg-1][0])))
+			copypipe(segs, nseg, cmdline); // cat or tee runs right here
+		else if((pid = forkjob(segs, nseg, bg, cmdline, -1)) != 0 && bg == 0)
+			waitfg(pid);
+		expand_done();
+		return;
+	}
+
+	if(redirect(argv, save) < 0) { // builtins get <, >, >> and 2> too
+		last_status = 1;
+	}
+	else if(argv[0] == NULL) { // only redirections, like "> file"
+		last_status = 0;
+	}
+	else if((fn = getfunc(argv[0])) != NULL) { // a shell function
+		callfunc(fn, argv);
+	}
+	else {
+		last_status = 0; // builtins set it when they fail
+		if(builtin_cmd(argv) == 0) { // runs a built in command, or forks
+			pid = forkjob(segs, 1, bg, cmdline, -1); // the child inherits the redirections
+			if(bg == 0) { // if it is a foreground job
+				unredirect(save);
+				waitfg(pid); // waits to finish it
+				expand_done();
+				return;
+			}
+		}
+	}
+	unredirect(save);
+	expand_done(); // release this line's expansions
+return;
+}
+
+/*
+ * forkjob - Fork a child that runs the pipeline segs[0..nseg) as a
+ *    new job and add it to the job list.  The child closes closefd
+ *    first, if it is not -1.  Returns the child's pid; the caller
+ *    waits for foreground jobs.
+ */
+pid_t forkjob(char ***segs, int nseg, int bg, char *cmdline, int closefd)
+{
+	char **envp;
+	sigset_t mask; // initialize variable of sigset and pid
+    	pid_t pid;
+
+	envp = buildenv(); // built here so the shell keeps it for the next fork
+	fflush(stdout); // or the child would print our buffered output again
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+       	sigprocmask(SIG_BLOCK, &mask, NULL); // blocking child signal
+       	pid = fork(); // forking
+
+	if(pid < 0) {
+		unix_error("fork error");
+	}
+
+	if(pid == 0) { // if it is a child
+		setpgid(0, 0); // puts child in new process group
+		sigprocmask(SIG_UNBLOCK, &mask, NULL); // unblocks child signal
+		Signal(SIGINT, SIG_DFL); // ctrl-c and ctrl-z act on builtins run here too
+		Signal(SIGTSTP, SIG_DFL);
+		if(closefd >= 0) // the shell's end of a pipe
+			close(closefd);
+		if(applyassigns(1) > 0) // name=value words go into this command's environment
+			envp = buildenv();
+		run_pipeline(segs, nseg, envp);
+	}
+
+	if(bg == 0) { // if it is a foreground job
+		addjob(jobs, pid, FG, cmdline); // adds to the FG jobs
+		sigprocmask(SIG_UNBLOCK, &mask, NULL); // unblocks child signal once the job is listed
+	}
+	else { // if it is a background job
+		addjob(jobs, pid, BG, cmdline); // add to the BG jobs
+		lastbg = pid; // for $!
+		printf("[%d] (%d) %s", pid2jid(pid), pid, cmdline); // before the handler can reap it
+		sigprocmask(SIG_UNBLOCK, &mask, NULL); // unblocks child signal once the job is listed
+	}
+	return pid;
+}
+
+/***********************************************
+ * Shell variables and the exec environment
+ **********************************************/
+
+/*
+ * Variable names are interned: each name has exactly one struct var,
+ * found with a single hash lookup, so the rest of the shell can hold
+ * on to the pointer instead of looking the name up again.  Values are
+ * reference counted and are only changed in place while nobody else
+ * shares them, so "a=$b" takes a reference instead of a copy and
+ * "s+=x" appends in place when s is the only owner.
+ *
+ * The envp handed to execve is kept between commands and is only
+ * rebuilt when an exported variable has changed since the last exec.
+ */
+
+struct value {              /* a shared, copy-on-write string value */
+    int refs;
+    size_t len;
+    size_t cap;
+    char s[];
+};
+
+struct var {                /* an interned variable */
+    struct var *next;       /* hash chain */
+    struct value *val;      /* NULL while unset */
+    int exported;
+    char *envstr;           /* cached "name=value" for the exec environment */
+    struct node *func;      /* body, if a function of this name exists */
+    struct pool *funcpool;  /* and the pool it lives in */
+    char name[];
+};
+struct var *vartab[VARBUCKETS];
+
+char **envv;                /* environment passed to execve */
+int envcap;
+int envdirty = 1;           /* an exported variable changed */
+
+/*
+ * intern - Return the variable for name[0..len), creating it (unset)
+ *    on first use
+ */
+struct var *intern(const char *name, size_t len)
+{
+    unsigned h = 5381;
+    size_t i;
+    struct var *v;
+
+    for (i = 0; i < len; i++)
+	h = h * 33 + (unsigned char)name[i];
+    h %= VARBUCKETS;
+    for (v = vartab[h]; v != NULL; v = v->next)
+	if (strncmp(v->name, name, len) == 0 && v->name[len] == '\0')
+	    return v;
+
+    if ((v = calloc(1, sizeof(struct var) + len + 1)) == NULL)
+	unix_error("intern error");
+    memcpy(v->name, name, len);
+    v->next = vartab[h];
+    vartab[h] = v;
+    return v;
+}
+
+/*
+ * isname - Is s[0..len) a valid variable name?
+ */
+int isname(const char *s, size_t len)
+{
+    size_t i;
+
+    if (len == 0 || isdigit((unsigned char)*s))
+	return 0;
+    for (i = 0; i < len; i++)
+	if (!isalnum((unsigned char)s[i]) && s[i] != '_')
+	    return 0;
+    return 1;
+}
+
+/*
+ * dropvalue - Release one reference to a value
+ */
+void dropvalue(struct value *val)
+{
+    if (val != NULL && --val->refs == 0)
+	free(val);
+}
+
+/*
+ * varchanged - Invalidate what was derived from the value of v
+ */
+void varchanged(struct var *v)
+{
+    if (v->envstr != NULL) {
+	free(v->envstr);
+	v->envstr = NULL;
+    }
+    if (v->exported)
+	envdirty = 1;
+}
+
+/*
+ * setvalue - Make val the value of v.  The caller's reference to val
+ *    is handed over; NULL unsets v.
+ */
+void setvalue(struct var *v, struct value *val)
+{
+    dropvalue(v->val);
+    v->val = val;
+    varchanged(v);
+}
+
+/*
+ * setvar - Set v to s[0..len), or append s if append is set
+ */
+void setvar(struct var *v, const char *s, size_t len, int append)
+{
+    struct value *old = v->val, *val;
+    size_t base = (append && old != NULL) ? old->len : 0;
+    size_t cap;
+
+    if (old != NULL && old->refs == 1 && base + len <= old->cap) {
+	memmove(old->s + base, s, len);
+	old->len = base + len;
+	old->s[old->len] = '\0';
+	varchanged(v);
+	return;
+    }
+
+    cap = base + len < 16 ? 16 : base + len;
+    if (append && old != NULL && cap < 2 * old->cap)
+	cap = 2 * old->cap;
+    if ((val = malloc(sizeof(struct value) + cap + 1)) == NULL)
+	unix_error("setvar error");
+    val->refs = 1;
+    val->cap = cap;
+    val->len = base + len;
+    if (base > 0)
+	memcpy(val->s, old->s, base);
+    memcpy(val->s + base, s, len);
+    val->s[val->len] = '\0';
+    setvalue(v, val);
+}
+
+/*
+ * getvar - Return the value of the variable called name, or NULL
+ */
+char *getvar(const char *name)
+{
+    struct var *v = intern(name, strlen(name));
+
+    return v->val ? v->val->s : NULL;
+}
+
+/*
+ * getfunc - Return the variable holding the function called name, if
+ *    there is such a function
+ */
+struct var *getfunc(const char *name)
+{
+    struct var *v = intern(name, strlen(name));
+
+    return v->func ? v : NULL;
+}
+
+/*
+ * initvars - Import the environment tsh was started with
+ */
+void initvars(void)
+{
+    char **e;
+
+    for (e = environ; *e != NULL; e++) {
+	char *eq = strchr(*e, '=');
+	struct var *v;
+
+	if (eq == NULL || !isname(*e, eq - *e))
+	    continue;
+	v = intern(*e, eq - *e);
+	v->exported = 1;
+	setvar(v, eq + 1, strlen(eq + 1), 0);
+    }
+}
+
+/*
+ * buildenv - Return the envp for execve, rebuilding it only if an
+ *    exported variable changed since it was last built
+ */
+char **buildenv(void)
+{
+    struct var *v;
+    int i, n = 0;
+
+    if (!envdirty && envv != NULL)
+	return envv;
+
+    for (i = 0; i < VARBUCKETS; i++) {
+	for (v = vartab[i]; v != NULL; v = v->next) {
+	    if (!v->exported || v->val == NULL)
+		continue;
+	    if (v->envstr == NULL) {
+		size_t len = strlen(v->name);
+		if ((v->envstr = malloc(len + v->val->len + 2)) == NULL)
+		    unix_error("buildenv error");
+		memcpy(v->envstr, v->name, len);
+		v->envstr[len] = '=';
+		memcpy(v->envstr + len + 1, v->val->s, v->val->len + 1);
+	    }
+	    if (n + 2 > envcap) {
+		envcap = envcap ? envcap * 2 : 64;
+		if ((envv = realloc(envv, envcap * sizeof(char *))) == NULL)
+		    unix_error("buildenv error");
+	    }
+	    envv[n++] = v->envstr;
+	}
+    }
+    if (envv == NULL && (envv = malloc(sizeof(char *))) == NULL)
+	unix_error("buildenv error");
+    envv[n] = NULL;
+    envdirty = 0;
+    return envv;
+}
+
+/*
+ * do_export - Execute the builtin export command
+ */
+void do_export(char **argv)
+{
+    struct var *v;
+    int i;
+
+    if (argv[1] == NULL) { /* list the exported variables */
+	for (i = 0; i < VARBUCKETS; i++)
+	    for (v = vartab[i]; v != NULL; v = v->next)
+		if (v->exported && v->val != NULL)
+		    printf("export %s='%s'\n", v->name, v->val->s);
+	return;
+    }
+
+    for (i = 1; argv[i] != NULL; i++) {
+	char *eq = strchr(argv[i], '=');
+	size_t len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+
+	if (!isname(argv[i], len)) {
+	    printf("export: %s: not a valid identifier\n", argv[i]);
+	    last_status = 1;
+	    continue;
+	}
+	v = intern(argv[i], len);
+	if (!v->exported) {
+	    v->exported = 1;
+	    envdirty = 1;
+	}
+	if (eq != NULL)		/* without a value, keep the one it has */
+	    setvar(v, eq + 1, strlen(eq + 1), 0);
+    }
+}
+
+/*
+ * do_unset - Execute the builtin unset command
+ */
+void do_unset(char **argv)
+{
+    int i;
+
+    for (i = 1; argv[i] != NULL; i++) {
+	struct var *v = intern(argv[i], strlen(argv[i]));
+
+	setvalue(v, NULL);
+	if (v->exported) {
+	    v->exported = 0;
+	    envdirty = 1;
+	}
+    }
+}
+
+/*
+ * do_local - Execute the builtin local command.  The variables' old
+ *    values are restored when the function returns.
+ */
+void do_local(char **argv)
+{
+    int i;
+
+    if (funcdepth == 0) {
+	printf("local: can only be used in a function\n");
+	last_status = 1;
+	return;
+    }
+    for (i = 1; argv[i] != NULL; i++) {
+	char *eq = strchr(argv[i], '=');
+	size_t len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+	struct var *v;
+
+	if (!isname(argv[i], len)) {
+	    printf("local: `%s': not a valid identifier\n", argv[i]);
+	    last_status = 1;
+	    continue;
+	}
+	if (nlocals == MAXLOCALS) {
+	    printf("local: too many local variables\n");
+	    last_status = 1;
+	    return;
+	}
+	v = intern(argv[i], len);
+	locals[nlocals].var = v;
+	locals[nlocals].val = v->val;     /* the reference moves here */
+	locals[nlocals].exported = v->exported;
+	nlocals++;
+	if (v->val != NULL)
+	    v->val->refs++;
+	if (eq != NULL)
+	    setvar(v, eq + 1, strlen(eq + 1), 0);
+	else
+	    setvalue(v, NULL);
+    }
+}
+
+/*
+ * Arithmetic expansion, $((...)), is evaluated here by a recursive
+ * descent parser over the C operators, so loop counters never need
+ * an external expr.  noeval is set while parsing the side of && || ?:
+ * that is not taken, where assignments and errors are suppressed.
+ */
+struct arith {
+    const char *p;
+    int noeval;
+    char *err;              /* first error, NULL if none */
+};
+
+long arith_assign(struct arith *a);
+
+/*
+ * arith_match - Consume op if it comes next and is not the start of
+ *    a longer operator (any of the characters in longer following it)
+ */
+int arith_match(struct arith *a, const char *op, const char *longer)
+{
+    size_t n = strlen(op);
+
+    while (isspace((unsigned char)*a->p))
+	a->p++;
+    if (strncmp(a->p, op, n) != 0 || (a->p[n] && strchr(longer, a->p[n])))
+	return 0;
+    a->p += n;
+    return 1;
+}
+
+/*
+ * arith_name - Consume a variable name if one comes next
+ */
+struct var *arith_name(struct arith *a)
+{
+    const char *start;
+
+    while (isspace((unsigned char)*a->p))
+	a->p++;
+    if (!isalpha((unsigned char)*a->p) && *a->p != '_')
+	return NULL;
+    for (start = a->p; isalnum((unsigned char)*a->p) || *a->p == '_'; a->p++)
+	;
+    return intern(start, a->p - start);
+}
+
+/*
+ * arith_get - Numeric value of a variable (unset or empty is 0)
+ */
+long arith_get(struct var *v)
+{
+    return v->val ? strtol(v->val->s, NULL, 0) : 0;
+}
+
+/*
+ * arith_set - Store n in v unless this side is not being evaluated
+ */
+long arith_set(struct arith *a, struct var *v, long n)
+{
+    char buf[32];
+
+    if (!a->noeval)
+	setvar(v, buf, snprintf(buf, sizeof(buf), "%ld", n), 0);
+    return n;
+}
+
+/*
+ * arith_unary - Numbers, variables, (expr), unary operators and ++/--
+ */
+long arith_unary(struct arith *a)
+{
+    struct var *v;
+    long n;
+
+    if (arith_match(a, "++", "") || arith_match(a, "--", "")) {
+	int inc = a->p[-1] == '+' ? 1 : -1;
+	if ((v = arith_name(a)) == NULL) {
+	    a->err = "variable expected";
+	    return 0;
+	}
+	return arith_set(a, v, arith_get(v) + inc);
+    }
+    if (arith_match(a, "+", "="))
+	return arith_unary(a);
+    if (arith_match(a, "-", "="))
+	return -arith_unary(a);
+    if (arith_match(a, "!", "="))
+	return !arith_unary(a);
+    if (arith_match(a, "~", ""))
+	return ~arith_unary(a);
+
+    if (arith_match(a, "(", "")) {
+	n = arith_assign(a);
+	if (!arith_match(a, ")", ""))
+	    a->err = "missing )";
+	return n;
+    }
+    if (isdigit((unsigned char)*a->p)) {
+	char *end;
+	n = strtol(a->p, &end, 0);
+	a->p = end;
+	return n;
+    }
+    if ((v = arith_name(a)) != NULL) {
+	n = arith_get(v);
+	if (arith_match(a, "++", ""))
+	    arith_set(a, v, n + 1);
+	else if (arith_match(a, "--", ""))
+	    arith_set(a, v, n - 1);
+	return n;
+    }
+    a->err = "syntax error";
+    return 0;
+}
+
+/*
+ * arith_divide - l / r or l % r (op is '/' or '%') for nonzero r.
+ *    LONG_MIN / -1 overflows, and traps; like bash, give LONG_MIN
+ *    for it, and 0 for LONG_MIN % -1.
+ */
+long arith_divide(char op, long l, long r)
+{
+    if (r == -1)
+	return op == '/' ? (long)(0UL - (unsigned long)l) : 0;
+    return op == '/' ? l / r : l % r;
+}
+
+/*
+ * arith_shift - l << r or l >> r (op is '<' or '>'), shifting by the
+ *    low 6 bits of r, as the CPU does, and on unsigned long so that
+ *    no shift is undefined.  >> keeps the sign, as in bash.
+ */
+long arith_shift(char op, long l, long r)
+{
+    unsigned long u = (unsigned long)l;
+    int n = (int)(r & 63);
+
+    if (op == '<')
+	return (long)(u << n);
+    return (long)(l < 0 ? ~(~u >> n) : u >> n);
+}
+
+/*
+ * arith_binary - Binary operators, by precedence level (0 is ||)
+ */
+long arith_binary(struct arith *a, int level)
+{
+    long l, r;
+
+    if (level > 9)
+	return arith_unary(a);
+    l = arith_binary(a, level + 1);
+
+    while (a->err == NULL) {
+	switch (level) {
+	case 0:
+	    if (!arith_match(a, "||", ""))
+		return l;
+	    a->noeval += !!l;
+	    r = arith_binary(a, level + 1);
+	    a->noeval -= !!l;
+	    l = l || r;
+	    continue;
+	case 1:
+	    if (!arith_match(a, "&&", ""))
+		return l;
+	    a->noeval += !l;
+	    r = arith_binary(a, level + 1);
+	    a->noeval -= !l;
+	    l = l && r;
+	    continue;
+	case 2:
+	    if (!arith_match(a, "|", "|="))
+		return l;
+	    l |= arith_binary(a, level + 1);
+	    continue;
+	case 3:
+	    if (!arith_match(a, "^", "="))
+		return l;
+	    l ^= arith_binary(a, level + 1);
+	    continue;
+	case 4:
+	    if (!arith_match(a, "&", "&="))
+		return l;
+	    l &= arith_binary(a, level + 1);
+	    continue;
+	case 5:
+	    if (arith_match(a, "==", ""))
+		l = l == arith_binary(a, level + 1);
+	    else if (arith_match(a, "!=", ""))
+		l = l != arith_binary(a, level + 1);
+	    else
+		return l;
+	    continue;
+	case 6:
+	    if (arith_match(a, "<=", ""))
+		l = l <= arith_binary(a, level + 1);
+	    else if (arith_match(a, ">=", ""))
+		l = l >= arith_binary(a, level + 1);
+	    else if (arith_match(a, "<", "<="))
+		l = l < arith_binary(a, level + 1);
+	    else if (arith_match(a, ">", ">="))
+		l = l > arith_binary(a, level + 1);
+	    else
+		return l;
+	    continue;
+	case 7:
+	    if (arith_match(a, "<<", "="))
+		l = arith_shift('<', l, arith_binary(a, level + 1));
+	    else if (arith_match(a, ">>", "="))
+		l = arith_shift('>', l, arith_binary(a, level + 1));
+	    else
+		return l;
+	    continue;
+	case 8:
+	    if (arith_match(a, "+", "+="))
+		l = l + arith_binary(a, level + 1);
+	    else if (arith_match(a, "-", "-="))
+		l = l - arith_binary(a, level + 1);
+	    else
+		return l;
+	    continue;
+	case 9:
+	    if (arith_match(a, "*", "="))
+		l = l * arith_binary(a, level + 1);
+	    else if (arith_match(a, "/", "=") || arith_match(a, "%", "=")) {
+		char op = a->p[-1];
+		r = arith_binary(a, level + 1);
+		if (r == 0) {
+		    if (!a->noeval)
+			a->err = "division by 0";
+		    r = 1;
+		}
+		l = arith_divide(op, l, r);
+	    }
+	    else
+		return l;
+	    continue;
+	}
+    }
+    return l;
+}
+
+/*
+ * arith_assign - Assignment and ?: (both right associative)
+ */
+long arith_assign(struct arith *a)
+{
+    static const char *ops[] = { "=", "+=", "-=", "*=", "/=", "%=",
+				 "<<=", ">>=", "&=", "^=", "|=", NULL };
+    const char *save = a->p;
+    struct var *v;
+    long l, r, e;
+    int i;
+
+    if ((v = arith_name(a)) != NULL) {
+	for (i = 0; ops[i] != NULL; i++)
+	    if (arith_match(a, ops[i], "="))
+		break;
+	if (ops[i] != NULL) {
+	    r = arith_assign(a);
+	    l = arith_get(v);
+	    switch (ops[i][0]) {
+	    case '=': l = r; break;
+	    case '+': l += r; break;
+	    case '-': l -= r; break;
+	    case '*': l *= r; break;
+	    case '<': case '>': l = arith_shift(ops[i][0], l, r); break;
+	    case '&': l &= r; break;
+	    case '^': l ^= r; break;
+	    case '|': l |= r; break;
+	    default:
+		if (r == 0) {
+		    if (!a->noeval)
+			a->err = "division by 0";
+		    return 0;
+		}
+		l = arith_divide(ops[i][0], l, r);
+	    }
+	    return arith_set(a, v, l);
+	}
+	a->p = save;
+    }
+
+    l = arith_binary(a, 0);
+    if (a->err == NULL && arith_match(a, "?", "")) {
+	a->noeval += !l;
+	r = arith_assign(a);
+	a->noeval -= !l;
+	if (!arith_match(a, ":", "")) {
+	    a->err = "missing :";
+	    return 0;
+	}
+	a->noeval += !!l;
+	e = arith_assign(a);
+	a->noeval -= !!l;
+	l = l ? r : e;
+    }
+    return l;
+}
+
+/*
+ * arith - Evaluate the arithmetic expression expr.  Returns 0 and
+ *    sets *result, or prints an error and returns -1.
+ */
+int arith(const char *expr, long *result)
+{
+    struct arith a;
+
+    a.p = expr;
+    a.noeval = 0;
+    a.err = NULL;
+    *result = arith_assign(&a);
+    while (isspace((unsigned char)*a.p))
+	a.p++;
+    if (a.err == NULL && *a.p != '\0')
+	a.err = "syntax error";
+    if (a.err != NULL) {
+	printf("%s: arithmetic %s\n", expr, a.err);
+	return -1;
+    }
+    return 0;
+}
+
+/***********************************************
+ * Word expansion: parameters, quote removal and wildcards
+ **********************************************/
+
+/*
+ * Expansion turns the raw words of a parsed command into the argv that is
+ * actually run.  Parameters ($name, ${...}, $? ...) and $((...)) are
+ * substituted, unquoted substitutions are split at blanks, quotes and
+ * backslashes are removed, and any word with an unquoted *, ? or [...]
+ * is replaced by the sorted list of matching path names (or kept as is
+ * when nothing matches).  A path component of exactly ** matches zero
+ * or more directories.
+ *
+ * Everything produced here lives only until the command has been run,
+ * so strings come from a per-line bump allocator and directory listings
+ * from a per-line cache; expand_done() releases both at once.
+ */
+
+struct lchunk {             /* one chunk of per-line storage */
+    struct lchunk *next;
+    size_t size;
+    size_t used;
+    char mem[];
+};
+struct lchunk *lchunks;     /* chunks in use by the current line */
+struct lchunk *lspare;      /* recycled chunks */
+
+struct field {              /* a field being built by expandword() */
+    struct strbuf lit;      /* text with quotes removed */
+    struct strbuf pat;      /* same, with quoted wildcards escaped */
+    int meta;               /* has an unquoted wildcard */
+    int openset;            /* has seen an unquoted [ */
+    int any;                /* kept even if empty (had quotes) */
+    int noargs;             /* was just "$@" with no parameters */
+};
+
+struct assign {             /* a leading name=value word */
+    struct var *var;
+    char *value;
+    size_t len;
+    int append;             /* name+=value */
+    struct var *share;      /* name=$share: take its value as is */
+};
+struct assign assigns[MAXARGS];
+int nassigns;
+
+int expandword(const char *p, const char *end, struct field *f, struct argvec *out);
+
+/* Glob pattern operations */
+#define GOP_LIT  0          /* literal text */
+#define GOP_ANY  1          /* ? */
+#define GOP_STAR 2          /* * */
+#define GOP_SET  3          /* [...] */
+
+struct globop {             /* one compiled pattern operation */
+    int type;
+    int len;                /* GOP_LIT: length of lit */
+    char *lit;              /* GOP_LIT: unescaped text */
+    unsigned char *set;     /* GOP_SET: 256-bit membership map */
+};
+
+struct globpat {            /* a compiled path component pattern */
+    struct globop *ops;
+    int nops;
+    size_t minlen;          /* shortest name that can match */
+    int dotok;              /* pattern may match names starting with '.' */
+};
+
+/* Path component kinds */
+#define GC_LIT   0          /* no wildcards, used verbatim */
+#define GC_PAT   1          /* compiled pattern */
+#define GC_STAR2 2          /* ** */
+
+struct globcomp {
+    int kind;
+    char *lit;
+    struct globpat pat;
+};
+
+struct dirlist {            /* cached listing of one directory */
+    struct dirlist *next;
+    char *path;
+    char *names;            /* NUL-separated entry names */
+    size_t *off;            /* offset of each name in names */
+    unsigned char *type;    /* d_type of each entry */
+    int n;
+};
+struct dirlist *dircache[DCBUCKETS];
+char *dirbuf;               /* getdents64 buffer, reused for every scan */
+
+struct linux_dirent64 {     /* record layout returned by getdents64 */
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct globctx {            /* state of one pattern's directory walk */
+    struct globcomp *comps;
+    int ncomps;
+    char *path;             /* path of the directory being walked */
+    size_t cap;
+    struct argvec *out;
+    int dirsonly;           /* the pattern ends in '/': directories only */
+};
+
+/*
+ * lalloc - Allocate n bytes of storage that lives until expand_done()
+ */
+void *lalloc(size_t n)
+{
+    struct lchunk *c = lchunks;
+    void *p;
+
+    n = (n + 7) & ~(size_t)7;
+    if (c == NULL || c->size - c->used < n) {
+	if (lspare != NULL && n <= LCHUNK) {
+	    c = lspare;
+	    lspare = c->next;
+	}
+	else {
+	    size_t size = n > LCHUNK ? n : LCHUNK;
+	    if ((c = malloc(sizeof(struct lchunk) + size)) == NULL)
+		unix_error("lalloc error");
+	    c->size = size;
+	}
+	c->used = 0;
+	c->next = lchunks;
+	lchunks = c;
+    }
+    p = c->mem + c->used;
+    c->used += n;
+    return p;
+}
+
+/*
+ * lstrdup - Copy the first n bytes of s into per-line storage
+ */
+char *lstrdup(const char *s, size_t n)
+{
+    char *p = lalloc(n + 1);
+
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+/*
+ * argpush - Append s to a NULL-terminated argument vector
+ */
+void argpush(struct argvec *av, char *s)
+{
+    if (av->n + 2 > av->cap) {
+	av->cap = av->cap ? av->cap * 2 : MAXARGS;
+	if ((av->v = realloc(av->v, av->cap * sizeof(char *))) == NULL)
+	    unix_error("argpush error");
+    }
+    av->v[av->n++] = s;
+    av->v[av->n] = NULL;
+}
+
+/*
+ * compileset - Compile the [...] expression starting at p into set.
+ *    Returns a pointer just past the closing ']', or NULL if there
+ *    is none (the '[' is then an ordinary character).
+ */
+const char *compileset(const char *p, const char *end, unsigned char *set)
+{
+    int neg = 0, i, first = 1;
+
+    p++;
+    if (p < end && (*p == '!' || *p == '^')) {
+	neg = 1;
+	p++;
+    }
+    memset(set, 0, 32);
+    while (p < end && (*p != ']' || first)) {
+	unsigned char lo, hi;
+
+	first = 0;
+	if (*p == '\\' && p+1 < end)
+	    p++;
+	lo = hi = *p++;
+	if (p+1 < end && *p == '-' && p[1] != ']') {
+	    p++;
+	    if (*p == '\\' && p+1 < end)
+		p++;
+	    hi = *p++;
+	}
+	for (i = lo; i <= hi; i++)
+	    set[i >> 3] |= 1 << (i & 7);
+    }
+    if (p >= end)
+	return NULL;
+    if (neg)
+	for (i = 0; i < 32; i++)
+	    set[i] = ~set[i];
+    set['/' >> 3] &= ~(1 << ('/' & 7));
+    return p + 1;
+}
+
+/*
+ * compileglob - Compile the escaped pattern p[0..len) for one path
+ *    component.  Returns the number of wildcard operations in it.
+ */
+int compileglob(const char *p, size_t len, struct globpat *gp)
+{
+    const char *end = p + len;
+    char *text = lalloc(len + 1);
+    int nmeta = 0;
+
+    gp->ops = lalloc((len + 1) * sizeof(struct globop));
+    gp->nops = 0;
+    gp->minlen = 0;
+    gp->dotok = (len > 0 && *p == '.') || (len > 1 && p[0] == '\\' && p[1] == '.');
+
+    while (p < end) {
+	struct globop *op = &gp->ops[gp->nops];
+	const char *next;
+
+	if (*p == '*') {
+	    if (gp->nops == 0 || op[-1].type != GOP_STAR) {
+		op->type = GOP_STAR;
+		gp->nops++;
+	    }
+	    p++;
+	    nmeta++;
+	    continue;
+	}
+	if (*p == '?') {
+	    op->type = GOP_ANY;
+	    gp->nops++;
+	    gp->minlen++;
+	    p++;
+	    nmeta++;
+	    continue;
+	}
+	if (*p == '[') {
+	    unsigned char *set = lalloc(32);
+	    if ((next = compileset(p, end, set)) != NULL) {
+		op->type = GOP_SET;
+		op->set = set;
+		gp->nops++;
+		gp->minlen++;
+		p = next;
+		nmeta++;
+		continue;
+	    }
+	}
+
+	/* literal character: extend the current run or start a new one */
+	if (*p == '\\' && p+1 < end)
+	    p++;
+	if (gp->nops == 0 || op[-1].type != GOP_LIT) {
+	    op->type = GOP_LIT;
+	    op->lit = text;
+	    op->len = 0;
+	    gp->nops++;
+	    op++;
+	}
+	op[-1].lit[op[-1].len++] = *p++;
+	text++;
+	gp->minlen++;
+    }
+    return nmeta;
+}
+
+/*
+ * globmatch - Return true if name[0..n) matches the compiled pattern.
+ *    Only the position after the most recent * is ever retried, so a
+ *    name is matched in O(n) for the usual single-star patterns.
+ */
+int globmatch(const struct globpat *gp, const char *name, size_t n)
+{
+    int i = 0, star = -1;
+    size_t p = 0, restart = 0;
+
+    if (n < gp->minlen || (*name == '.' && !gp->dotok))
+	return 0;
+
+    while (1) {
+	if (i < gp->nops) {
+	    const struct globop *op = &gp->ops[i];
+	    unsigned char c = p < n ? name[p] : 0;
+
+	    switch (op->type) {
+	    case GOP_STAR:
+		star = ++i;
+		restart = p;
+		continue;
+	    case GOP_LIT:
+		if (n - p >= (size_t)op->len &&
+		    memcmp(name + p, op->lit, op->len) == 0) {
+		    p += op->len;
+		    i++;
+		    continue;
+		}
+		break;
+	    case GOP_ANY:
+		if (p < n) {
+		    p++;
+		    i++;
+		    continue;
+		}
+		break;
+	    case GOP_SET:
+		if (p < n && (op->set[c >> 3] & (1 << (c & 7)))) {
+		    p++;
+		    i++;
+		    continue;
+		}
+		break;
+	    }
+	}
+	else if (p == n) {
+	    return 1;
+	}
+
+	/* mismatch: let the last * swallow one more character */
+	if (star < 0 || restart >= n)
+	    return 0;
+	i = star;
+	p = ++restart;
+    }
+}
+
+/*
+ * dirlist_get - Return the listing of directory path ("" means the
+ *    current directory), reading it with getdents64 on first use.
+ *    Unreadable directories are cached as empty.
+ */
+struct dirlist *dirlist_get(const char *path)
+{
+    unsigned h = 5381;
+    const char *s;
+    struct dirlist *dl;
+    size_t used = 0, cap = 0;
+    int fd, cnt = 0;
+    long nread;
+
+    for (s = path; *s; s++)
+	h = h * 33 + (unsigned char)*s;
+    h %= DCBUCKETS;
+    for (dl = dircache[h]; dl != NULL; dl = dl->next)
+	if (strcmp(dl->path, path) == 0)
+	    return dl;
+
+    if ((dl = calloc(1, sizeof(struct dirlist))) == NULL ||
+	(dl->path = strdup(path)) == NULL)
+	unix_error("dirlist error");
+    dl->next = dircache[h];
+    dircache[h] = dl;
+
+    if ((fd = open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+	return dl;
+    if (dirbuf == NULL && (dirbuf = malloc(DIRBUF)) == NULL)
+	unix_error("dirlist error");
+
+    while ((nread = syscall(SYS_getdents64, fd, dirbuf, DIRBUF)) > 0) {
+	long pos;
+
+	for (pos = 0; pos < nread; ) {
+	    struct linux_dirent64 *d = (struct linux_dirent64 *)(dirbuf + pos);
+	    size_t len = strlen(d->d_name);
+
+	    pos += d->d_reclen;
+	    if (d->d_name[0] == '.' && (len == 1 || (len == 2 && d->d_name[1] == '.')))
+		continue;
+	    if (used + len + 1 > cap || dl->n == cnt) {
+		cap = cap ? cap * 2 : DIRBUF;
+		while (used + len + 1 > cap)
+		    cap *= 2;
+		cnt = cnt ? cnt * 2 : 256;
+		if ((dl->names = realloc(dl->names, cap)) == NULL ||
+		    (dl->off = realloc(dl->off, cnt * sizeof(size_t))) == NULL ||
+		    (dl->type = realloc(dl->type, cnt)) == NULL)
+		    unix_error("dirlist error");
+	    }
+	    memcpy(dl->names + used, d->d_name, len + 1);
+	    dl->off[dl->n] = used;
+	    dl->type[dl->n] = d->d_type;
+	    dl->n++;
+	    used += len + 1;
+	}
+    }
+    close(fd);
+    return dl;
+}
+
+/*
+ * globpath - Make room for n more bytes at offset len of the walk path
+ */
+void globpath(struct globctx *g, size_t len, size_t n)
+{
+    if (len + n + 2 > g->cap) {
+	while (len + n + 2 > g->cap)
+	    g->cap *= 2;
+	if ((g->path = realloc(g->path, g->cap)) == NULL)
+	    unix_error("glob error");
+    }
+}
+
+/*
+ * isdir - Is entry i of dl (inside directory g->path[0..len)) a
+ *    directory?  Symbolic links are followed only if follow is set.
+ */
+int isdir(struct globctx *g, size_t len, struct dirlist *dl, int i, int follow)
+{
+    struct stat sb;
+    const char *name = dl->names + dl->off[i];
+    size_t n = strlen(name);
+    int r;
+
+    if (dl->type[i] == DT_DIR)
+	return 1;
+    if (dl->type[i] != DT_UNKNOWN && !(follow && dl->type[i] == DT_LNK))
+	return 0;
+    globpath(g, len, n);
+    memcpy(g->path + len, name, n + 1);
+    r = follow ? stat(g->path, &sb) : lstat(g->path, &sb);
+    return r == 0 && S_ISDIR(sb.st_mode);
+}
+
+/*
+ * globfound - Add the match g->path[0..len) to the output; with a
+ *    trailing slash if the pattern had one
+ */
+void globfound(struct globctx *g, size_t len)
+{
+    if (g->dirsonly)
+	g->path[len++] = '/';
+    argpush(g->out, lstrdup(g->path, len));
+}
+
+/*
+ * globwalk - Match components ci.. of the pattern below the directory
+ *    g->path[0..len), which is empty or ends with '/'.
+ */
+void globwalk(struct globctx *g, size_t len, int ci)
+{
+    struct globcomp *c = &g->comps[ci];
+    int last = (ci == g->ncomps - 1);
+    struct dirlist *dl;
+    struct stat sb;
+    int i;
+
+    if (c->kind == GC_LIT) {
+	size_t n = strlen(c->lit);
+
+	globpath(g, len, n);
+	memcpy(g->path + len, c->lit, n + 1);
+	if (!last) {
+	    g->path[len + n] = '/';
+	    globwalk(g, len + n + 1, ci + 1);
+	}
+	else if (g->dirsonly ? stat(g->path, &sb) == 0 && S_ISDIR(sb.st_mode)
+			     : lstat(g->path, &sb) == 0) {
+	    globfound(g, len + n);
+	}
+	return;
+    }
+
+    g->path[len] = '\0';
+    dl = dirlist_get(g->path);
+
+    if (c->kind == GC_STAR2 && !last)
+	globwalk(g, len, ci + 1);          /* ** matching no directory */
+
+    for (i = 0; i < dl->n; i++) {
+	const char *name = dl->names + dl->off[i];
+	size_t n;
+
+	if (c->kind == GC_STAR2) {
+	    if (*name == '.')
+		continue;
+	    n = strlen(name);
+	    if (last && (!g->dirsonly || isdir(g, len, dl, i, 1))) {
+		globpath(g, len, n);
+		memcpy(g->path + len, name, n);
+		globfound(g, len + n);
+	    }
+	    if (isdir(g, len, dl, i, 0)) {
+		globpath(g, len, n);
+		memcpy(g->path + len, name, n);
+		g->path[len + n] = '/';
+		globwalk(g, len + n + 1, ci);
+	    }
+	    continue;
+	}
+
+	n = strlen(name);
+	if (!globmatch(&c->pat, name, n))
+	    continue;
+	if (last) {
+	    if (g->dirsonly && !isdir(g, len, dl, i, 1))
+		continue;
+	    globpath(g, len, n);
+	    memcpy(g->path + len, name, n);
+	    globfound(g, len + n);
+	}
+	else if (isdir(g, len, dl, i, 1)) {
+	    globpath(g, len, n);
+	    memcpy(g->path + len, name, n);
+	    g->path[len + n] = '/';
+	    globwalk(g, len + n + 1, ci + 1);
+	}
+    }
+}
+
+/*
+ * argcmp - qsort comparison for sorting glob matches
+ */
+int argcmp(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * globexpand - Append the path names matching the escaped pattern pat
+ *    to out, sorted.  Returns the number of names added.
+ */
+int globexpand(const char *pat, struct argvec *out)
+{
+    static struct globctx g;
+    const char *p = pat, *start;
+    int first = out->n, ncomps = 1;
+
+    for (start = pat; *start; start++)
+	if (*start == '/')
+	    ncomps++;
+    g.comps = lalloc(ncomps * sizeof(struct globcomp));
+    g.ncomps = 0;
+    g.out = out;
+    g.dirsonly = 0;
+    if (g.path == NULL) {
+	g.cap = 256;
+	if ((g.path = malloc(g.cap)) == NULL)
+	    unix_error("glob error");
+    }
+
+    /* split the pattern into components at unescaped slashes */
+    while (*p == '/')
+	p++;
+    while (*p) {
+	struct globcomp *c = &g.comps[g.ncomps];
+
+	start = p;
+	while (*p && *p != '/')
+	    p += (*p == '\\' && p[1]) ? 2 : 1;
+	if (p - start == 2 && start[0] == '*' && start[1] == '*') {
+	    c->kind = GC_STAR2;
+	}
+	else if (compileglob(start, p - start, &c->pat) > 0) {
+	    c->kind = GC_PAT;
+	}
+	else {
+	    const char *s;
+	    char *d = c->lit = lalloc(p - start + 1);
+	    c->kind = GC_LIT;
+	    for (s = start; s < p; s++) {
+		if (*s == '\\' && s+1 < p)
+		    s++;
+		*d++ = *s;
+	    }
+	    *d = '\0';
+	}
+	g.ncomps++;
+	if (*p == '/') {
+	    while (*p == '/')
+		p++;
+	    g.dirsonly = (*p == '\0');
+	}
+    }
+    if (g.ncomps == 0)
+	return 0;
+
+    if (*pat == '/') {
+	strcpy(g.path, "/");
+	globwalk(&g, 1, 0);
+    }
+    else {
+	globwalk(&g, 0, 0);
+    }
+
+    qsort(out->v + first, out->n - first, sizeof(char *), argcmp);
+    return out->n - first;
+}
+
+/*
+ * sbput - Append s[0..n) to a string buffer, keeping it NUL-terminated
+ */
+void sbput(struct strbuf *sb, const char *s, size_t n)
+{
+    if (sb->len + n + 1 > sb->cap) {
+	sb->cap = sb->cap ? sb->cap * 2 : 256;
+	while (sb->len + n + 1 > sb->cap)
+	    sb->cap *= 2;
+	if ((sb->s = realloc(sb->s, sb->cap)) == NULL)
+	    unix_error("sbput error");
+    }
+    memcpy(sb->s + sb->len, s, n);
+    sb->len += n;
+    sb->s[sb->len] = '\0';
+}
+
+/*
+ * fieldchar - Add one character to the field being built.  Quoted
+ *    wildcard characters are escaped in the pattern copy.
+ */
+void fieldchar(struct field *f, char c, int quoted)
+{
+    if (quoted && strchr("*?[]\\", c))
+	sbput(&f->pat, "\\", 1);
+    else if (!quoted && (c == '*' || c == '?'))
+	f->meta = 1;
+    else if (!quoted && c == '[')
+	f->openset = 1;
+    else if (!quoted && c == ']' && f->openset)
+	f->meta = 1;
+    sbput(&f->pat, &c, 1);
+    sbput(&f->lit, &c, 1);
+}
+
+/*
+ * clearfield - Start a new, empty field
+ */
+void clearfield(struct field *f)
+{
+    f->lit.len = f->pat.len = 0;
+    f->meta = f->openset = f->any = f->noargs = 0;
+}
+
+/*
+ * endfield - Finish the current field: append it (or, if it is a
+ *    pattern with matches, the matching paths) to out and start anew.
+ *    Empty fields are dropped unless they came from quotes.
+ */
+void endfield(struct field *f, struct argvec *out)
+{
+    if (f->lit.len > 0 || (f->any && !f->noargs)) {
+	if (!f->meta || globexpand(f->pat.s, out) == 0)
+	    argpush(out, lstrdup(f->lit.s ? f->lit.s : "", f->lit.len));
+    }
+    clearfield(f);
+}
+
+/*
+ * specialparam - Append the value of a special or positional
+ *    parameter ($?, $$, $!, $#, $0, $1..., $@, $*) to val.  Returns
+ *    whether the parameter is set.
+ */
+int specialparam(const char *name, size_t len, struct strbuf *val)
+{
+    char buf[32];
+    int i;
+
+    if (isdigit((unsigned char)*name)) {
+	/* Only the len digits of the name: $12 is $1 and then a 2. */
+	for (i = 0; len > 0 && i <= pos.n; len--, name++)
+	    i = i * 10 + (*name - '0');
+	if (i == 0) {
+	    sbput(val, "tsh", 3);
+	    return 1;
+	}
+	if (i > pos.n)
+	    return 0;
+	sbput(val, pos.v[i-1], strlen(pos.v[i-1]));
+	return 1;
+    }
+
+    switch (*name) {
+    case '?':
+	sbput(val, buf, sprintf(buf, "%d", last_status));
+	return 1;
+    case '$':
+	sbput(val, buf, sprintf(buf, "%d", (int)getpid()));
+	return 1;
+    case '!':
+	if (lastbg <= 0)
+	    return 0;
+	sbput(val, buf, sprintf(buf, "%d", (int)lastbg));
+	return 1;
+    case '#':
+	sbput(val, buf, sprintf(buf, "%d", pos.n));
+	return 1;
+    case '@': case '*':
+	for (i = 0; i < pos.n; i++) {
+	    if (i > 0)
+		sbput(val, " ", 1);
+	    sbput(val, pos.v[i], strlen(pos.v[i]));
+	}
+	return pos.n > 0;
+    }
+    return 0;
+}
+
+/*
+ * expandparam - Expand the $ expression at *pp, appending its value
+ *    to val and leaving *pp just past it.  Handles $name, ${name},
+ *    ${#name}, ${name[:]-word} (also =, + and ?), the special
+ *    parameters and $((expr)).  Returns 1 if the $ is not the start
+ *    of an expansion, -1 (after printing why) on error, 0 otherwise.
+ */
+int expandparam(const char **pp, const char *end, struct strbuf *val)
+{
+    const char *p = *pp + 1, *name, *word = NULL, *wend = NULL;
+    size_t namelen;
+    int length = 0, colon = 0, set;
+    char op = 0;
+    struct strbuf cur = { NULL, 0, 0 };
+    struct var *v = NULL;
+
+    if (p + 1 < end && p[0] == '(' && p[1] == '(') { /* $((expr)) */
+	struct field f;
+	int depth = 0;
+	long n;
+	char buf[32];
+
+	for (p += 2; p < end; p++) {
+	    if (*p == '(')
+		depth++;
+	    else if (*p == ')' && depth > 0)
+		depth--;
+	    else if (*p == ')' && p + 1 < end && p[1] == ')')
+		break;
+	}
+	if (p >= end) {
+	    printf("%.*s: missing ))\n", (int)(end - *pp), *pp);
+	    return -1;
+	}
+	memset(&f, 0, sizeof(f));
+	if (expandword(*pp + 3, p, &f, NULL) < 0 ||
+	    arith(f.lit.s ? f.lit.s : "0", &n) < 0) {
+	    free(f.lit.s);
+	    free(f.pat.s);
+	    return -1;
+	}
+	free(f.lit.s);
+	free(f.pat.s);
+	sbput(val, buf, sprintf(buf, "%ld", n));
+	*pp = p + 2;
+	return 0;
+    }
+
+    if (p < end && *p == '{') { /* ${...} */
+	const char *q;
+	int depth = 1;
+	char quote = 0;
+
+	for (q = ++p; q < end; q++) {
+	    if (quote) {
+		if (*q == quote)
+		    quote = 0;
+	    }
+	    else if (*q == '\\' && q + 1 < end)
+		q++;
+	    else if (*q == '\'' || *q == '"')
+		quote = *q;
+	    else if (*q == '{')
+		depth++;
+	    else if (*q == '}' && --depth == 0)
+		break;
+	}
+	if (q >= end) {
+	    printf("%.*s: bad substitution\n", (int)(end - *pp), *pp);
+	    return -1;
+	}
+	*pp = q + 1;
+	end = q;
+
+	if (*p == '#' && p + 1 < end) {
+	    length = 1;
+	    p++;
+	}
+	name = p;
+	if (p < end && (isalpha((unsigned char)*p) || *p == '_'))
+	    while (p < end && (isalnum((unsigned char)*p) || *p == '_'))
+		p++;
+	else if (p < end && isdigit((unsigned char)*p))
+	    while (p < end && isdigit((unsigned char)*p))
+		p++;
+	else if (p < end && strchr("?$!#@*", *p))
+	    p++;
+	namelen = p - name;
+	if (p < end && *p == ':') {
+	    colon = 1;
+	    p++;
+	}
+	if (p < end && !length && strchr("-=+?", *p)) {
+	    op = *p++;
+	    word = p;
+	    wend = end;
+	}
+	else if (namelen == 0 || p < end) {
+	    printf("${%.*s}: bad substitution\n", (int)(end - name), name);
+	    return -1;
+	}
+    }
+    else {
+	name = p;
+	if (p < end && (isalpha((unsigned char)*p) || *p == '_'))
+	    while (p < end && (isalnum((unsigned char)*p) || *p == '_'))
+		p++;
+	else if (p < end && strchr("?$!#@*0123456789", *p))
+	    p++;
+	namelen = p - name;
+	if (namelen == 0)
+	    return 1;
+	*pp = p;
+    }
+
+    /* look the parameter up */
+    if (isname(name, namelen)) {
+	v = intern(name, namelen);
+	set = v->val != NULL;
+	if (set)
+	    sbput(&cur, v->val->s, v->val->len);
+    }
+    else {
+	set = specialparam(name, namelen, &cur);
+    }
+
+    if (length) {
+	char buf[32];
+	sbput(val, buf, sprintf(buf, "%zu", cur.len));
+	free(cur.s);
+	return 0;
+    }
+
+    if (colon && cur.len == 0)
+	set = 0;
+    if (op == 0 || (set && op != '+') || (!set && op == '+')) {
+	if (op != '+' && cur.len > 0)
+	    sbput(val, cur.s, cur.len);
+	free(cur.s);
+	return 0;
+    }
+    free(cur.s);
+
+    /* the word part is needed: ${name-word} and friends */
+    {
+	struct field f;
+	int r = 0;
+
+	memset(&f, 0, sizeof(f));
+	if (expandword(word, wend, &f, NULL) < 0) {
+	    r = -1;
+	}
+	else if (op == '?') {
+	    printf("%.*s: %s\n", (int)namelen, name,
+		   f.lit.len ? f.lit.s : "parameter null or not set");
+	    r = -1;
+	}
+	else {
+	    if (f.lit.len > 0)
+		sbput(val, f.lit.s, f.lit.len);
+	    if (op == '=') {
+		if (v == NULL) {
+		    printf("%.*s: cannot assign in this way\n", (int)namelen, name);
+		    r = -1;
+		}
+		else {
+		    setvar(v, f.lit.s ? f.lit.s : "", f.lit.len, 0);
+		}
+	    }
+	}
+	free(f.lit.s);
+	free(f.pat.s);
+	return r;
+    }
+}
+
+/*
+ * expandword - Expand the raw word text p[0..end) into the field f:
+ *    remove quotes, substitute parameters and mark wildcards.  If out
+ *    is not NULL the results of unquoted substitutions are split at
+ *    blanks, and each completed field except the last is ended into
+ *    out; the caller ends the last one.  With out NULL the whole word
+ *    is left in f->lit.  Returns -1 on a failed substitution.
+ */
+int expandword(const char *p, const char *end, struct field *f, struct argvec *out)
+{
+    struct strbuf val = { NULL, 0, 0 };
+    int dq = 0;
+    size_t i;
+
+    while (p < end) {
+	char c = *p;
+
+	if (c == '\'' && !dq) {
+	    const char *q = memchr(p + 1, '\'', end - p - 1);
+	    if (q == NULL)
+		q = end;
+	    for (p++; p < q; p++)
+		fieldchar(f, *p, 1);
+	    f->any = 1;
+	    p = q < end ? q + 1 : end;
+	    continue;
+	}
+	if (c == '"') {
+	    dq = !dq;
+	    f->any = 1;
+	    p++;
+	    continue;
+	}
+	if (c == '\\' && p + 1 < end) {
+	    if (dq && !strchr("\"\\$`", p[1])) {
+		fieldchar(f, '\\', 1);
+		p++;
+	    }
+	    else {
+		fieldchar(f, p[1], 1);
+		p += 2;
+	    }
+	    continue;
+	}
+	if (c == '$' && dq && out != NULL &&
+	    (strncmp(p, "$@", 2) == 0 || strncmp(p, "${@}", 4) == 0)) {
+	    /* "$@" gives one field per positional parameter */
+	    for (i = 0; i < (size_t)pos.n; i++) {
+		const char *s;
+		if (i > 0)
+		    endfield(f, out);
+		for (s = pos.v[i]; *s; s++)
+		    fieldchar(f, *s, 1);
+		f->any = 1;
+	    }
+	    if (pos.n == 0)
+		f->noargs = 1;
+	    p += (p[1] == '@') ? 2 : 4;
+	    continue;
+	}
+	if (c == '$') {
+	    int r;
+
+	    val.len = 0;
+	    if ((r = expandparam(&p, end, &val)) < 0) {
+		free(val.s);
+		return -1;
+	    }
+	    if (r == 1) {
+		fieldchar(f, '$', dq);
+		p++;
+		continue;
+	    }
+	    for (i = 0; i < val.len; i++) {
+		if (out != NULL && !dq && strchr(" \t\n", val.s[i]))
+		    endfield(f, out);
+		else
+		    fieldchar(f, val.s[i], dq);
+	    }
+	    continue;
+	}
+	fieldchar(f, c, dq);
+	p++;
+    }
+    free(val.s);
+    return 0;
+}
+
+/*
+ * expandargs - Build the argv that will actually be run from the raw
+ *    words of a command.  With assignok set, leading name=value words
+ *    are not part of argv; they are expanded and kept for applyassigns().
+ *    The result stays valid until expand_done() is called.  Returns
+ *    NULL if a substitution failed.
+ */
+char **expandargs(char **argv, int assignok)
+{
+    static struct field f;
+    int i;
+
+    xargv.n = 0;
+    nassigns = 0;
+
+    for (i = 0; assignok && argv[i] != NULL; i++) { /* leading assignments */
+	struct assign *as = &assigns[nassigns];
+	char *eq = strchr(argv[i], '=');
+	char *val;
+	size_t len;
+
+	if (eq == NULL)
+	    break;
+	len = eq - argv[i];
+	as->append = (len > 0 && argv[i][len-1] == '+');
+	if (!isname(argv[i], len - as->append))
+	    break;
+	as->var = intern(argv[i], len - as->append);
+
+	/* a plain name=$other shares the value instead of copying it */
+	val = eq + 1;
+	as->share = NULL;
+	if (val[0] == '$' && val[1] == '{' && val[strlen(val)-1] == '}' &&
+	    isname(val + 2, strlen(val) - 3))
+	    as->share = intern(val + 2, strlen(val) - 3);
+	else if (val[0] == '$' && isname(val + 1, strlen(val) - 1))
+	    as->share = intern(val + 1, strlen(val) - 1);
+
+	clearfield(&f);
+	if (as->share == NULL && expandword(val, val + strlen(val), &f, NULL) < 0)
+	    return NULL;
+	as->value = lstrdup(f.lit.s ? f.lit.s : "", f.lit.len);
+	as->len = f.lit.len;
+	nassigns++;
+    }
+
+    for (; argv[i] != NULL; i++) {
+	clearfield(&f);
+	if (expandword(argv[i], argv[i] + strlen(argv[i]), &f, &xargv) < 0)
+	    return NULL;
+	endfield(&f, &xargv);
+    }
+
+    if (xargv.v == NULL) {
+	argpush(&xargv, NULL);
+	xargv.n = 0;
+    }
+    xargv.v[xargv.n] = NULL;
+    return xargv.v;
+}
+
+/*
+ * applyassigns - Perform the name=value words of the last command
+ *    expanded.  With export set the variables are also exported, as
+ *    in the environment of an external command.  Returns how many
+ *    assignments there were.
+ */
+int applyassigns(int export)
+{
+    int i;
+
+    for (i = 0; i < nassigns; i++) {
+	struct assign *as = &assigns[i];
+
+	if (export && !as->var->exported) {
+	    as->var->exported = 1;
+	    envdirty = 1;
+	}
+	if (as->share != NULL && !as->append && as->share->val != NULL) {
+	    as->share->val->refs++;
+	    setvalue(as->var, as->share->val);
+	}
+	else if (as->share != NULL) { /* appending, or $other is unset: "" */
+	    struct value *val = as->share->val;
+	    setvar(as->var, val ? val->s : "", val ? val->len : 0, as->append);
+	}
+	else {
+	    setvar(as->var, as->value, as->len, as->append);
+	}
+    }
+    return nassigns;
+}
+
+/*
+ * expand_done - Release everything allocated while expanding a line
+ */
+void expand_done(void)
+{
+    struct lchunk *c;
+    struct dirlist *dl;
+    int i;
+
+    while ((c = lchunks) != NULL) {
+	lchunks = c->next;
+	if (c->size == LCHUNK) {
+	    c->next = lspare;
+	    lspare = c;
+	}
+	else {
+	    free(c);
+	}
+    }
+
+    for (i = 0; i < DCBUCKETS; i++) {
+	while ((dl = dircache[i]) != NULL) {
+	    dircache[i] = dl->next;
+	    free(dl->path);
+	    free(dl->names);
+	    free(dl->off);
+	    free(dl->type);
+	    free(dl);
+	}
+    }
+}
+
+/***********************************************
+ * Parsing command text into command trees
+ **********************************************/
+
+/*
+ * Command text is parsed once into a tree of struct node, and loop and
+ * function bodies are run straight from the tree as often as needed.
+ * Words are stored in their raw form and are only expanded (see
+ * expandargs) right before a simple command runs.
+ *
+ * The grammar is a subset of the POSIX shell grammar:
+ *     list     : andor ((';' | '&' | newline) andor)*
+ *     andor    : pipeline (('&&' | '||') newline* pipeline)*
+ *     pipeline : ['!'] command
+ *     command  : simple | if | while | until | for | case
+ *              | '{' list '}' | name '(' ')' newline* command
+ * A simple command is a run of words.  |, <, >, >> and 2> are words
+ * as well; they are handled when the command runs.
+ */
+
+/*
+ * palloc - Allocate n bytes that live as long as the pool
+ */
+void *palloc(struct pool *pool, size_t n)
+{
+    struct lchunk *c = pool->chunks;
+    void *p;
+
+    n = (n + 7) & ~(size_t)7;
+    if (c == NULL || c->size - c->used < n) {
+	size_t size = n > PCHUNK ? n : PCHUNK;
+	if ((c = malloc(sizeof(struct lchunk) + size)) == NULL)
+	    unix_error("palloc error");
+	c->size = size;
+	c->used = 0;
+	c->next = pool->chunks;
+	pool->chunks = c;
+    }
+    p = c->mem + c->used;
+    c->used += n;
+    return p;
+}
+
+/*
+ * droppool - Release one reference to a pool, freeing it with the
+ *    trees in it when the last one goes
+ */
+void droppool(struct pool *pool)
+{
+    struct lchunk *c;
+
+    if (pool == NULL || --pool->refs > 0)
+	return;
+    while ((c = pool->chunks) != NULL) {
+	pool->chunks = c->next;
+	free(c);
+    }
+    free(pool);
+}
+
+/*
+ * scanword - Return the end of the word starting at p.  Quotes,
+ *    ${...} and $((...)) may contain blanks and operator characters.
+ */
+const char *scanword(struct parser *ps, const char *p)
+{
+    while (*p && !strchr(" \t\n;&()", *p) && !(p[0] == '|' && p[1] == '|')) {
+	if (*p == '\\') {
+	    p += p[1] ? 2 : 1;
+	}
+	else if (*p == '\'' || *p == '"') {
+	    char quote = *p++;
+
+	    while (*p && *p != quote)
+		p += (quote == '"' && *p == '\\' && p[1]) ? 2 : 1;
+	    if (*p == '\0') {
+		ps->more = 1;
+		return p;
+	    }
+	    p++;
+	}
+	else if (*p == '$' && (p[1] == '{' || p[1] == '(')) {
+	    char open = p[1], close = (open == '{') ? '}' : ')';
+	    int depth = 0;
+
+	    for (p++; *p; p++) {
+		if (*p == open)
+		    depth++;
+		else if (*p == close && --depth == 0)
+		    break;
+	    }
+	    if (*p == '\0') {
+		ps->more = 1;
+		return p;
+	    }
+	    p++;
+	}
+	else {
+	    p++;
+	}
+    }
+    return p;
+}
+
+/*
+ * lex - Read the next token
+ */
+void lex(struct parser *ps)
+{
+    const char *p = ps->p;
+
+    ps->prevend = ps->end;
+    while (1) {
+	while (*p == ' ' || *p == '\t')
+	    p++;
+	if (*p == '\\' && p[1] == '\n')   /* line continuation */
+	    p += 2;
+	else if (*p == '#')               /* comment */
+	    while (*p && *p != '\n')
+		p++;
+	else
+	    break;
+    }
+
+    ps->start = p;
+    switch (*p) {
+    case '\0':
+	ps->tok = T_EOF;
+	break;
+    case '\n':
+	ps->tok = T_NEWLINE;
+	p++;
+	break;
+    case ';':
+	ps->tok = (p[1] == ';') ? T_DSEMI : T_SEMI;
+	p += (p[1] == ';') ? 2 : 1;
+	break;
+    case '&':
+	ps->tok = (p[1] == '&') ? T_AND : T_AMP;
+	p += (p[1] == '&') ? 2 : 1;
+	break;
+    case '(':
+	ps->tok = T_LPAREN;
+	p++;
+	break;
+    case ')':
+	ps->tok = T_RPAREN;
+	p++;
+	break;
+    default:
+	if (p[0] == '|' && p[1] == '|') {
+	    ps->tok = T_OR;
+	    p += 2;
+	}
+	else {
+	    ps->tok = T_WORD;
+	    p = scanword(ps, p);
+	}
+    }
+    ps->end = p;
+    ps->p = p;
+}
+
+/*
+ * isword - Is the current token the word w?
+ */
+int isword(struct parser *ps, const char *w)
+{
+    size_t n = ps->end - ps->start;
+
+    return ps->tok == T_WORD && strlen(w) == n && strncmp(ps->start, w, n) == 0;
+}
+
+/*
+ * endword - Is the current token a keyword that ends a list?
+ */
+int endword(struct parser *ps)
+{
+    return isword(ps, "then") || isword(ps, "else") || isword(ps, "elif") ||
+	isword(ps, "fi") || isword(ps, "do") || isword(ps, "done") ||
+	isword(ps, "esac") || isword(ps, "}");
+}
+
+/*
+ * synerr - Report that the current token was not expected.  At the
+ *    end of the text that only means more input is needed.
+ */
+void synerr(struct parser *ps)
+{
+    if (ps->err || ps->more)
+	return;
+    if (ps->tok == T_EOF) {
+	ps->more = 1;
+	return;
+    }
+    ps->err = 1;
+    if (ps->tok == T_NEWLINE)
+	printf("syntax error near unexpected newline\n");
+    else
+	printf("syntax error near '%.*s'\n", (int)(ps->end - ps->start), ps->start);
+}
+
+/*
+ * expect - Consume the keyword w, or report a syntax error
+ */
+void expect(struct parser *ps, const char *w)
+{
+    if (isword(ps, w))
+	lex(ps);
+    else
+	synerr(ps);
+}
+
+/*
+ * skipnl - Skip newline tokens
+ */
+void skipnl(struct parser *ps)
+{
+    while (ps->tok == T_NEWLINE)
+	lex(ps);
+}
+
+/*
+ * pstrdup - Copy s[0..n) into the parse pool
+ */
+char *pstrdup(struct parser *ps, const char *s, size_t n)
+{
+    char *p = palloc(ps->pool, n + 1);
+
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+/*
+ * cmdtext - Copy the source text start..end, as shown by the job
+ *    list, into the parse pool
+ */
+char *cmdtext(struct parser *ps, const char *start, const char *end)
+{
+    size_t n = end - start;
+    char *text;
+
+    if (n > MAXLINE - 2)
+	n = MAXLINE - 2;
+    text = palloc(ps->pool, n + 2);
+    memcpy(text, start, n);
+    text[n] = '\n';
+    text[n+1] = '\0';
+    return text;
+}
+
+/*
+ * newnode - Allocate an empty node
+ */
+struct node *newnode(struct parser *ps, int type)
+{
+    struct node *n = palloc(ps->pool, sizeof(struct node));
+
+    memset(n, 0, sizeof(struct node));
+    n->type = type;
+    return n;
+}
+
+/*
+ * wordlist - Copy a list of words into a NULL-terminated array in the
+ *    parse pool
+ */
+char **wordlist(struct parser *ps, struct argvec *av)
+{
+    char **words = palloc(ps->pool, (av->n + 1) * sizeof(char *));
+
+    memcpy(words, av->v, av->n * sizeof(char *));
+    words[av->n] = NULL;
+    return words;
+}
+
+struct node *parse_list(struct parser *ps);
+struct node *parse_command(struct parser *ps);
+
+/*
+ * parse_simple - A simple command: the words up to the next operator
+ */
+struct node *parse_simple(struct parser *ps)
+{
+    struct argvec words = { NULL, 0, 0 };
+    const char *start = ps->start;
+    struct node *n;
+
+    while (ps->tok == T_WORD) {
+	argpush(&words, pstrdup(ps, ps->start, ps->end - ps->start));
+	lex(ps);
+    }
+    if (words.n == 0) {
+	synerr(ps);
+	return NULL;
+    }
+    n = newnode(ps, N_CMD);
+    n->words = wordlist(ps, &words);
+    n->text = cmdtext(ps, start, ps->prevend);
+    free(words.v);
+    return n;
+}
+
+/*
+ * parse_if - if/elif list then list [elif ...] [else list] fi
+ */
+struct node *parse_if(struct parser *ps)
+{
+    struct node *n = newnode(ps, N_IF);
+
+    lex(ps);
+    n->left = parse_list(ps);
+    expect(ps, "then");
+    n->right = parse_list(ps);
+    if (isword(ps, "elif")) {
+	n->elsep = parse_if(ps);   /* also consumes the fi */
+	return n;
+    }
+    if (isword(ps, "else")) {
+	lex(ps);
+	n->elsep = parse_list(ps);
+    }
+    expect(ps, "fi");
+    return n;
+}
+
+/*
+ * parse_while - while/until list do list done
+ */
+struct node *parse_while(struct parser *ps)
+{
+    struct node *n = newnode(ps, isword(ps, "while") ? N_WHILE : N_UNTIL);
+
+    lex(ps);
+    n->left = parse_list(ps);
+    expect(ps, "do");
+    n->right = parse_list(ps);
+    expect(ps, "done");
+    return n;
+}
+
+/*
+ * parse_for - for name [in word...] do list done
+ */
+struct node *parse_for(struct parser *ps)
+{
+    struct node *n = newnode(ps, N_FOR);
+
+    lex(ps);
+    if (ps->tok != T_WORD || !isname(ps->start, ps->end - ps->start)) {
+	synerr(ps);
+	return n;
+    }
+    n->var = intern(ps->start, ps->end - ps->start);
+    lex(ps);
+    skipnl(ps);
+    if (isword(ps, "in")) {
+	struct argvec words = { NULL, 0, 0 };
+
+	for (lex(ps); ps->tok == T_WORD; lex(ps))
+	    argpush(&words, pstrdup(ps, ps->start, ps->end - ps->start));
+	n->words = wordlist(ps, &words);
+	free(words.v);
+	if (ps->tok == T_SEMI)
+	    lex(ps);
+	else if (ps->tok != T_NEWLINE)
+	    synerr(ps);
+    }
+    else if (ps->tok == T_SEMI) {
+	lex(ps);
+    }
+    skipnl(ps);
+    expect(ps, "do");
+    n->right = parse_list(ps);
+    expect(ps, "done");
+    return n;
+}
+
+/*
+ * parse_case - case word in [(]pattern[|pattern...]) list ;; ... esac
+ */
+struct node *parse_case(struct parser *ps)
+{
+    struct node *n = newnode(ps, N_CASE), **tail = &n->left;
+
+    lex(ps);
+    if (ps->tok != T_WORD) {
+	synerr(ps);
+	return n;
+    }
+    n->word = pstrdup(ps, ps->start, ps->end - ps->start);
+    lex(ps);
+    skipnl(ps);
+    expect(ps, "in");
+    skipnl(ps);
+
+    while (!ps->err && !ps->more && !isword(ps, "esac")) {
+	struct argvec pats = { NULL, 0, 0 };
+	struct node *item = newnode(ps, N_ITEM);
+
+	if (ps->tok == T_LPAREN)
+	    lex(ps);
+	for (; ps->tok == T_WORD; lex(ps)) {
+	    /* a|b arrives as one word, a | b as three */
+	    const char *s = ps->start, *q = s;
+	    char quote = 0;
+
+	    for (; q <= ps->end; q++) {
+		if (q < ps->end && quote) {
+		    if (*q == quote)
+			quote = 0;
+		}
+		else if (q < ps->end && (*q == '\'' || *q == '"')) {
+		    quote = *q;
+		}
+		else if (q < ps->end && *q == '\\') {
+		    q++;
+		}
+		else if (q == ps->end || *q == '|') {
+		    if (q > s)
+			argpush(&pats, pstrdup(ps, s, q - s));
+		    s = q + 1;
+		}
+	    }
+	}
+	if (pats.n == 0 || ps->tok != T_RPAREN) {
+	    free(pats.v);
+	    synerr(ps);
+	    return n;
+	}
+	lex(ps);
+	item->words = wordlist(ps, &pats);
+	free(pats.v);
+	item->right = parse_list(ps);
+	*tail = item;
+	tail = &item->next;
+
+	if (ps->tok == T_DSEMI) {
+	    lex(ps);
+	    skipnl(ps);
+	}
+	else if (!isword(ps, "esac")) {
+	    synerr(ps);
+	}
+    }
+    expect(ps, "esac");
+    return n;
+}
+
+/*
+ * parse_command - One command, simple or compound
+ */
+struct node *parse_command(struct parser *ps)
+{
+    struct node *n;
+    struct parser save;
+
+    if (ps->tok != T_WORD || endword(ps)) {
+	synerr(ps);
+	return NULL;
+    }
+    if (isword(ps, "if"))
+	return parse_if(ps);
+    if (isword(ps, "while") || isword(ps, "until"))
+	return parse_while(ps);
+    if (isword(ps, "for"))
+	return parse_for(ps);
+    if (isword(ps, "case"))
+	return parse_case(ps);
+    if (isword(ps, "{")) {
+	n = newnode(ps, N_GROUP);
+	lex(ps);
+	n->left = parse_list(ps);
+	expect(ps, "}");
+	return n;
+    }
+
+    /* name () command defines a function */
+    save = *ps;
+    lex(ps);
+    if (ps->tok == T_LPAREN && isname(save.start, save.end - save.start)) {
+	n = newnode(ps, N_FUNC);
+	n->var = intern(save.start, save.end - save.start);
+	n->pool = ps->pool;
+	lex(ps);
+	if (ps->tok != T_RPAREN) {
+	    synerr(ps);
+	    return n;
+	}
+	lex(ps);
+	skipnl(ps);
+	n->left = parse_command(ps);
+	return n;
+    }
+    *ps = save;
+    return parse_simple(ps);
+}
+
+/*
+ * parse_pipeline - A command, optionally negated with !
+ */
+struct node *parse_pipeline(struct parser *ps)
+{
+    struct node *n;
+
+    if (!isword(ps, "!"))
+	return parse_command(ps);
+    lex(ps);
+    n = newnode(ps, N_NOT);
+    if ((n->left = parse_command(ps)) == NULL)
+	return NULL;
+    return n;
+}
+
+/*
+ * parse_andor - Pipelines joined by && and ||
+ */
+struct node *parse_andor(struct parser *ps)
+{
+    struct node *l, *n;
+
+    if ((l = parse_pipeline(ps)) == NULL)
+	return NULL;
+    while (ps->tok == T_AND || ps->tok == T_OR) {
+	n = newnode(ps, ps->tok == T_AND ? N_AND : N_OR);
+	lex(ps);
+	skipnl(ps);
+	n->left = l;
+	if ((n->right = parse_pipeline(ps)) == NULL)
+	    return NULL;
+	l = n;
+    }
+    return l;
+}
+
+/*
+ * parse_list - Commands separated by ;, & or newlines, up to the end
+ *    of the text or a keyword that closes the enclosing construct
+ */
+struct node *parse_list(struct parser *ps)
+{
+    struct node *head = NULL, **tail = &head, *n;
+
+    while (!ps->err && !ps->more) {
+	const char *start;
+
+	while (ps->tok == T_NEWLINE || ps->tok == T_SEMI)
+	    lex(ps);
+	if (ps->tok == T_EOF || ps->tok == T_DSEMI || ps->tok == T_RPAREN ||
+	    endword(ps))
+	    break;
+
+	start = ps->start;
+	if ((n = parse_andor(ps)) == NULL)
+	    break;
+	if (ps->tok == T_AMP) {
+	    n->bg = 1;
+	    n->text = cmdtext(ps, start, ps->end);
+	}
+	*tail = n;
+	tail = &n->next;
+
+	if (ps->tok != T_AMP && ps->tok != T_SEMI && ps->tok != T_NEWLINE)
+	    break;
+	lex(ps);
+    }
+    return head;
+}
+
+/*
+ * parse - Parse the command text into *prog, allocating the tree from
+ *    pool.  Returns 0 on success, 1 if the text is incomplete, and -1
+ *    (after printing a message) on a syntax error.
+ */
+int parse(const char *text, struct pool *pool, struct node **prog)
+{
+    struct parser ps;
+
+    memset(&ps, 0, sizeof(ps));
+    ps.p = text;
+    ps.pool = pool;
+    lex(&ps);
+    *prog = parse_list(&ps);
+    if (ps.tok != T_EOF)
+	synerr(&ps);
+    return ps.err ? -1 : ps.more ? 1 : 0;
+}
+
+/***********************************************
+ * Running command trees
+ **********************************************/
+
+/*
+ * unwinding - Is a break, continue, return or ctrl-c in progress?
+ */
+int unwinding(void)
+{
+    return breakn || contn || funcret || interrupted;
+}
+
+/*
+ * loopexit - Called by a loop after running its body or condition.
+ *    Consumes a pending break or continue aimed at this loop and
+ *    returns true if the loop must stop.
+ */
+int loopexit(void)
+{
+    if (funcret || interrupted)
+	return 1;
+    if (breakn) {
+	breakn--;
+	return 1;
+    }
+    if (contn)
+	return --contn > 0;
+    return 0;
+}
+
+/*
+ * exec_list - Run a list of commands; returns the last one's status
+ */
+int exec_list(struct node *n)
+{
+    for (; n != NULL && !unwinding(); n = n->next)
+	exec_node(n);
+    return last_status;
+}
+
+/*
+ * exec_bg - Run a compound command in the background, in a forked
+ *    copy of the shell
+ */
+void exec_bg(struct node *n)
+{
+    sigset_t mask;
+    pid_t pid;
+
+    fflush(stdout);
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    if ((pid = fork()) == 0) {
+	setpgid(0, 0);
+	sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	n->bg = 0;
+	exec_node(n);
+	fflush(stdout);
+	_exit(last_status);
+    }
+    addjob(jobs, pid, BG, n->text);
+    lastbg = pid;
+    /* Before the SIGCHLD handler can reap it and take its jid. */
+    printf("[%d] (%d) %s", pid2jid(pid), pid, n->text);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    last_status = 0;
+}
+
+/*
+ * exec_while - Run a while or until loop
+ */
+void exec_while(struct node *n)
+{
+    int status = 0;
+
+    loopdepth++;
+    while (1) {
+	exec_list(n->left);
+	if (unwinding()) {
+	    if (loopexit())
+		break;
+	    continue;
+	}
+	if ((last_status == 0) != (n->type == N_WHILE))
+	    break;
+	exec_list(n->right);
+	status = last_status;
+	if (loopexit())
+	    break;
+    }
+    loopdepth--;
+    last_status = status;
+}
+
+/*
+ * exec_for - Run a for loop.  The word list is expanded once, up
+ *    front, into storage of its own since every command in the body
+ *    recycles the per-command expansion storage.
+ */
+void exec_for(struct node *n)
+{
+    char **argv = pos.v, **list;
+    int i, count = pos.n, status = 0;
+
+    if (n->words != NULL) {
+	if ((argv = expandargs(n->words, 0)) == NULL) {
+	    last_status = 1;
+	    expand_done();
+	    return;
+	}
+	for (count = 0; argv[count] != NULL; count++)
+	    ;
+    }
+    if ((list = malloc((count + 1) * sizeof(char *))) == NULL)
+	unix_error("for error");
+    for (i = 0; i < count; i++)
+	if ((list[i] = strdup(argv[i])) == NULL)
+	    unix_error("for error");
+    expand_done();
+
+    loopdepth++;
+    for (i = 0; i < count; i++) {
+	setvar(n->var, list[i], strlen(list[i]), 0);
+	exec_list(n->right);
+	status = last_status;
+	if (loopexit())
+	    break;
+    }
+    loopdepth--;
+
+    for (i = 0; i < count; i++)
+	free(list[i]);
+    free(list);
+    last_status = status;
+}
+
+/*
+ * exec_case - Run the first case item with a pattern matching the word
+ */
+void exec_case(struct node *n)
+{
+    static struct field f;
+    struct node *item;
+    struct globpat gp;
+    char *subject;
+    int i;
+
+    clearfield(&f);
+    if (expandword(n->word, n->word + strlen(n->word), &f, NULL) < 0) {
+	last_status = 1;
+	return;
+    }
+    if ((subject = strdup(f.lit.s ? f.lit.s : "")) == NULL)
+	unix_error("case error");
+
+    last_status = 0;
+    for (item = n->left; item != NULL; item = item->next) {
+	for (i = 0; item->words[i] != NULL; i++) {
+	    clearfield(&f);
+	    if (expandword(item->words[i], item->words[i] + strlen(item->words[i]),
+			   &f, NULL) < 0) {
+		last_status = 1;
+		goto done;
+	    }
+	    compileglob(f.pat.s ? f.pat.s : "", f.pat.len, &gp);
+	    gp.dotok = 1;
+	    if (globmatch(&gp, subject, strlen(subject))) {
+		expand_done();
+		exec_list(item->right);
+		goto done;
+	    }
+	}
+    }
+ done:
+    expand_done();
+    free(subject);
+}
+
+/*
+ * setpositional - Replace the positional parameters with copies of
+ *    argv[0..n)
+ */
+void setpositional(int n, char **argv)
+{
+    int i;
+
+    for (i = 0; i < pos.n; i++)
+	free(pos.v[i]);
+    free(pos.v);
+    pos.n = n;
+    if ((pos.v = malloc((n + 1) * sizeof(char *))) == NULL)
+	unix_error("setpositional error");
+    for (i = 0; i < n; i++)
+	if ((pos.v[i] = strdup(argv[i])) == NULL)
+	    unix_error("setpositional error");
+    pos.v[n] = NULL;
+}
+
+/*
+ * callfunc - Run the shell function fn with arguments argv[1...]
+ */
+void callfunc(struct var *fn, char **argv)
+{
+    struct posargs saved = pos;
+    struct pool *pool = fn->funcpool;
+    int n, mark = nlocals;
+
+    if (funcdepth >= MAXDEPTH) {
+	printf("%s: maximum function nesting exceeded\n", argv[0]);
+	last_status = 1;
+	return;
+    }
+    for (n = 0; argv[n+1] != NULL; n++)
+	;
+    pos.n = 0;
+    pos.v = NULL;
+    setpositional(n, argv + 1);
+
+    pool->refs++;  /* the function may redefine itself */
+    funcdepth++;
+    exec_node(fn->func);
+    funcdepth--;
+    funcret = 0;
+    droppool(pool);
+
+    while (nlocals > mark) { /* restore what local saved */
+	struct local *l = &locals[--nlocals];
+	l->var->exported = l->exported;
+	setvalue(l->var, l->val);
+	envdirty = 1;
+    }
+    setpositional(0, NULL);
+    free(pos.v);
+    pos = saved;
+}
+
+/*
+ * exec_node - Run one command of a command tree
+ */
+void exec_node(struct node *n)
+{
+    if (n->bg && n->type != N_CMD) {
+	exec_bg(n);
+	return;
+    }
+
+    switch (n->type) {
+    case N_CMD:
+	exec_cmd(n);
+	break;
+    case N_AND:
+    case N_OR:
+	exec_node(n->left);
+	if (!unwinding() && (last_status == 0) == (n->type == N_AND))
+	    exec_node(n->right);
+	break;
+    case N_NOT:
+	exec_node(n->left);
+	last_status = !last_status;
+	break;
+    case N_GROUP:
+	exec_list(n->left);
+	break;
+    case N_IF:
+	exec_list(n->left);
+	if (unwinding())
+	    break;
+	if (last_status == 0)
+	    exec_list(n->right);
+	else if (n->elsep != NULL)
+	    exec_list(n->elsep);
+	else
+	    last_status = 0;
+	break;
+    case N_WHILE:
+    case N_UNTIL:
+	exec_while(n);
+	break;
+    case N_FOR:
+	exec_for(n);
+	break;
+    case N_CASE:
+	exec_case(n);
+	break;
+    case N_FUNC:
+	n->pool->refs++;
+	droppool(n->var->funcpool);
+	n->var->func = n->left;
+	n->var->funcpool = n->pool;
+	last_status = 0;
+	break;
+    }
+}
+
+/*
+ * test_unary - Evaluate the unary test operator op
+ */
+int test_unary(const char *op, const char *arg)
+{
+    struct stat sb;
+
+    switch (op[1]) {
+    case 'n': return *arg != '\0';
+    case 'z': return *arg == '\0';
+    case 'e': return stat(arg, &sb) == 0;
+    case 'f': return stat(arg, &sb) == 0 && S_ISREG(sb.st_mode);
+    case 'd': return stat(arg, &sb) == 0 && S_ISDIR(sb.st_mode);
+    case 's': return stat(arg, &sb) == 0 && sb.st_size > 0;
+    case 'L':
+    case 'h': return lstat(arg, &sb) == 0 && S_ISLNK(sb.st_mode);
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+    }
+    return 0;
+}
+
+/*
+ * isunary, isbinary - Is s a unary or binary test operator?
+ */
+int isunary(const char *s)
+{
+    return s[0] == '-' && s[1] != '\0' && s[2] == '\0' && strchr("nzefdsLhrwx", s[1]);
+}
+
+int isbinary(const char *s)
+{
+    static const char *ops[] = { "=", "==", "!=", "<", ">", "-eq", "-ne",
+				 "-lt", "-le", "-gt", "-ge", NULL };
+    int i;
+
+    for (i = 0; ops[i] != NULL; i++)
+	if (strcmp(s, ops[i]) == 0)
+	    return 1;
+    return 0;
+}
+
+struct testexpr {
+    char **a;               /* the operands */
+    int n;
+    int i;                  /* next one to look at */
+    int err;                /* 1: syntax error, 2: bad number */
+};
+
+/*
+ * test_number - Convert an operand of -eq and friends
+ */
+long test_number(struct testexpr *t, const char *s)
+{
+    char *end;
+    long n = strtol(s, &end, 10);
+
+    if (*s == '\0' || *end != '\0') {
+	printf("test: %s: integer expression expected\n", s);
+	t->err = 2;
+    }
+    return n;
+}
+
+/*
+ * test_binary - Evaluate a op b
+ */
+int test_binary(struct testexpr *t, const char *a, const char *op, const char *b)
+{
+    long x, y;
+
+    if (op[0] != '-') {
+	int c = strcmp(a, b);
+
+	switch (op[0]) {
+	case '=': return c == 0;
+	case '!': return c != 0;
+	case '<': return c < 0;
+	default:  return c > 0;
+	}
+    }
+    x = test_number(t, a);
+    y = test_number(t, b);
+    if (strcmp(op, "-eq") == 0) return x == y;
+    if (strcmp(op, "-ne") == 0) return x != y;
+    if (strcmp(op, "-lt") == 0) return x < y;
+    if (strcmp(op, "-le") == 0) return x <= y;
+    if (strcmp(op, "-gt") == 0) return x > y;
+    return x >= y;
+}
+
+int test_or(struct testexpr *t);
+
+/*
+ * test_primary - ! primary, ( expr ), a unary or binary test, or a
+ *    single string which is true if it is not empty
+ */
+int test_primary(struct testexpr *t)
+{
+    char **a = t->a;
+    int r;
+
+    if (t->i >= t->n) {
+	t->err = 1;
+	return 0;
+    }
+    if (t->i + 2 < t->n && isbinary(a[t->i+1])) {
+	t->i += 3;
+	return test_binary(t, a[t->i-3], a[t->i-2], a[t->i-1]);
+    }
+    if (strcmp(a[t->i], "!") == 0) {
+	t->i++;
+	return !test_primary(t);
+    }
+    if (strcmp(a[t->i], "(") == 0) {
+	t->i++;
+	r = test_or(t);
+	if (t->i >= t->n || strcmp(a[t->i], ")") != 0)
+	    t->err = 1;
+	t->i++;
+	return r;
+    }
+    if (t->i + 1 < t->n && isunary(a[t->i])) {
+	t->i += 2;
+	return test_unary(a[t->i-2], a[t->i-1]);
+    }
+    return a[t->i++][0] != '\0';
+}
+
+/*
+ * test_and, test_or - Primaries joined by -a and -o
+ */
+int test_and(struct testexpr *t)
+{
+    int r = test_primary(t);
+
+    while (t->i < t->n && strcmp(t->a[t->i], "-a") == 0) {
+	t->i++;
+	r = test_primary(t) && r;
+    }
+    return r;
+}
+
+int test_or(struct testexpr *t)
+{
+    int r = test_and(t);
+
+    while (t->i < t->n && strcmp(t->a[t->i], "-o") == 0) {
+	t->i++;
+	r = test_and(t) || r;
+    }
+    return r;
+}
+
+/*
+ * do_test - Execute the builtin test and [ commands
+ */
+void do_test(char **argv)
+{
+    struct testexpr t;
+    int r;
+
+    t.a = argv + 1;
+    for (t.n = 0; t.a[t.n] != NULL; t.n++)
+	;
+    t.i = 0;
+    t.err = 0;
+    if (strcmp(argv[0], "[") == 0) {
+	if (t.n == 0 || strcmp(t.a[t.n-1], "]") != 0) {
+	    printf("[: missing ]\n");
+	    last_status = 2;
+	    return;
+	}
+	t.n--;
+    }
+    if (t.n == 0) {
+	last_status = 1;
+	return;
+    }
+    r = test_or(&t);
+    if (t.err || t.i != t.n) {
+	if (t.err != 2)
+	    printf("%s: syntax error\n", argv[0]);
+	last_status = 2;
+	return;
+    }
+    last_status = !r;
+}
+
+/*
+ * loopcount - The optional count of break, continue, shift, ...
+ */
+int loopcount(char **argv, int dflt)
+{
+    char *end;
+    long n;
+
+    if (argv[1] == NULL)
+	return dflt;
+    n = strtol(argv[1], &end, 10);
+    if (*argv[1] == '\0' || *end != '\0' || n < 0) {
+	printf("%s: %s: numeric argument required\n", argv[0], argv[1]);
+	return -1;
+    }
+    return n;
+}
+
+/*
+ * do_script - Execute the builtins used by scripts: echo, true,
+ *    false, :, test, [, break, continue, return, shift and exit.
+ *    Returns 0 if argv[0] is none of them.
+ */
+int do_script(char **argv)
+{
+    char *cmd = argv[0];
+    int i, n;
+
+    if (strcmp(cmd, "echo") == 0) {
+	int nl = !(argv[1] && strcmp(argv[1], "-n") == 0);
+
+	for (i = nl ? 1 : 2; argv[i] != NULL; i++)
+	    printf("%s%s", argv[i], argv[i+1] ? " " : "");
+	if (nl)
+	    putchar('\n');
+    }
+    else if (strcmp(cmd, "true") == 0 || strcmp(cmd, ":") == 0) {
+	last_status = 0;
+    }
+    else if (strcmp(cmd, "false") == 0) {
+	last_status = 1;
+    }
+    else if (strcmp(cmd, "test") == 0 || strcmp(cmd, "[") == 0) {
+	do_test(argv);
+    }
+    else if (strcmp(cmd, "break") == 0 || strcmp(cmd, "continue") == 0) {
+	if ((n = loopcount(argv, 1)) <= 0) {
+	    last_status = 1;
+	    return 1;
+	}
+	if (loopdepth == 0)
+	    return 1;
+	if (n > loopdepth)
+	    n = loopdepth;
+	if (cmd[0] == 'b')
+	    breakn = n;
+	else
+	    contn = n;
+    }
+    else if (strcmp(cmd, "return") == 0) {
+	if ((n = loopcount(argv, last_status)) < 0)
+	    n = 2;
+	if (funcdepth == 0) {
+	    printf("return: can only be used in a function\n");
+	    last_status = 1;
+	    return 1;
+	}
+	last_status = n & 0xff;
+	funcret = 1;
+    }
+    else if (strcmp(cmd, "shift") == 0) {
+	if ((n = loopcount(argv, 1)) < 0 || n > pos.n) {
+	    last_status = 1;
+	    return 1;
+	}
+	for (i = 0; i < n; i++)
+	    free(pos.v[i]);
+	memmove(pos.v, pos.v + n, (pos.n - n + 1) * sizeof(char *));
+	pos.n -= n;
+    }
+    else if (strcmp(cmd, "exit") == 0) {
+	if ((n = loopcount(argv, last_status)) < 0)
+	    n = 2;
+	fflush(stdout);
+	exit(n & 0xff);
+    }
+    else {
+	return 0;
+    }
+    return 1;
+}
+
+/***********************************************
+ * Redirections, pipelines, and the cat and tee builtins
+ **********************************************/
+
+/*
+ * Builtins and functions run in the shell itself, so their
+ * redirections are undone again afterwards: redirect() keeps a copy
+ * of every descriptor it replaces.  A foreground pipeline that starts
+ * or ends with cat or tee runs that command in the shell too, and
+ * copyfd() then has the kernel move the data between the files and
+ * the pipe (copy_file_range, splice, sendfile, tee) instead of
+ * reading it into a buffer and writing it out again.
+ */
+
+/*
+ * movefd - Make fd refer to what newfd refers to.  Returns a copy of
+ *    the old fd, or -1 if it was not open, for restorefd().
+ */
+int movefd(int fd, int newfd)
+{
+    int saved = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+
+    if (saved < 0 && errno != EBADF)
+	unix_error("fcntl error");
+    if (dup2(newfd, fd) < 0)
+	unix_error("dup2 error");
+    return saved;
+}
+
+/*
+ * restorefd - Undo movefd()
+ */
+void restorefd(int fd, int saved)
+{
+    if (saved < 0) {
+	close(fd);
+    }
+    else {
+	dup2(saved, fd);
+	close(saved);
+    }
+}
+
+/*
+ * redirect - Carry out the <, >, >> and 2> redirections in argv and
+ *    remove them from it.  If save is not NULL the descriptors that
+ *    are replaced are kept there for unredirect().  Returns -1, after
+ *    printing a message, if a file could not be opened.
+ */
+int redirect(char **argv, int *save)
+{
+    int i, j, fd, target, flags;
+
+    if (save != NULL) {
+	fflush(stdout);
+	save[0] = save[1] = save[2] = -2;
+    }
+    for (i = j = 0; argv[i] != NULL; i++) {
+	if (strcmp(argv[i], "<") == 0) {
+	    target = 0;
+	    flags = O_RDONLY;
+	}
+	else if (strcmp(argv[i], ">") == 0) {
+	    target = 1;
+	    flags = O_WRONLY | O_CREAT | O_TRUNC;
+	}
+	else if (strcmp(argv[i], ">>") == 0) {
+	    target = 1;
+	    flags = O_WRONLY | O_CREAT | O_APPEND;
+	}
+	else if (strcmp(argv[i], "2>") == 0) {
+	    target = 2;
+	    flags = O_WRONLY | O_CREAT | O_TRUNC;
+	}
+	else {
+	    argv[j++] = argv[i];
+	    continue;
+	}
+
+	if (argv[++i] == NULL) {
+	    printf("syntax error near unexpected newline\n");
+	    argv[j] = NULL;
+	    return -1;
+	}
+	if ((fd = open(argv[i], flags, 0666)) < 0) {
+	    printf("%s: %s\n", argv[i], strerror(errno));
+	    argv[j] = NULL;
+	    return -1;
+	}
+	if (save != NULL && save[target] == -2)
+	    save[target] = movefd(target, fd);
+	else if (dup2(fd, target) < 0)
+	    unix_error("dup2 error");
+	close(fd);
+    }
+    argv[j] = NULL;
+    return 0;
+}
+
+/*
+ * unredirect - Put back the descriptors saved by redirect()
+ */
+void unredirect(int *save)
+{
+    int fd;
 
-/* Here are the functions that you will implement */
-void eval(char *cmdline);
-int builtin_cmd(char **argv);
-void do_bgfg(char **argv);
-void waitfg(pid_t pid);
+    fflush(stdout);
+    for (fd = 0; fd < 3; fd++)
+	if (save[fd] != -2)
+	    restorefd(fd, save[fd]);
+}
 
-void sigchld_handler(int sig);
-void sigtstp_handler(int sig);
-void sigint_handler(int sig);
+/*
+ * splitpipe - Split argv at each | into NULL-terminated commands.
+ *    Returns how many there are, or 0 if one of them is empty.
+ */
+int splitpipe(char **argv, char ***segs)
+{
+    int i, n = 0;
 
-/* Here are helper routines that we've provided for you */
-int parseline(const char *cmdline, char **argv); 
-void sigquit_handler(int sig);
+    segs[n++] = argv;
+    for (i = 0; argv[i] != NULL; i++) {
+	if (strcmp(argv[i], "|") == 0) {
+	    argv[i] = NULL;
+	    if (segs[n-1][0] == NULL)
+		return 0;
+	    segs[n++] = &argv[i+1];
+	}
+    }
+    return segs[n-1][0] == NULL ? 0 : n;
+}
 
-void clearjob(struct job_t *job);
-void initjobs(struct job_t *jobs);
-int maxjid(struct job_t *jobs); 
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline);
-int deletejob(struct job_t *jobs, pid_t pid); 
-pid_t fgpid(struct job_t *jobs);
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
-struct job_t *getjobjid(struct job_t *jobs, int jid); 
-int pid2jid(pid_t pid); 
-void listjobs(struct job_t *jobs);
+/*
+ * run_segment - Run one command of a pipeline in the current (child)
+ *    process.  Never returns.
+ */
+void run_segment(char **argv, char **envp)
+{
+    struct var *fn;
 
-void usage(void);
-void unix_error(char *msg);
-void app_error(char *msg);
-typedef void handler_t(int);
-handler_t *Signal(int signum, handler_t *handler);
+    if (redirect(argv, NULL) < 0)
+	_exit(1);
+    if (argv[0] == NULL)
+	_exit(0);
+    last_status = 0;
+    if ((fn = getfunc(argv[0])) != NULL)
+	callfunc(fn, argv);
+    else if (!builtin_cmd(argv)) {
+	execve(argv[0], argv, envp);
+	printf("%s: Command not found\n", argv[0]);
+	last_status = 127;
+    }
+    /* _exit: exit would also move the offset of a script being read
+       through stdio, which this process shares with the shell */
+    fflush(stdout);
+    _exit(last_status);
+}
 
 /*
- * main - The shell's main routine 
+ * run_pipeline - Run segs[0..nseg), connected by pipes.  The calling
+ *    process forks one child per command but the last, which it runs
+ *    itself, so its exit status is the pipeline's.  Never returns.
  */
-int main(int argc, char **argv) 
+void run_pipeline(char ***segs, int nseg, char **envp)
 {
-    char c;
-    char cmdline[MAXLINE];
-    int emit_prompt = 1; /* emit prompt (default) */
+    int i, fd[2], in = -1;
+    pid_t pid;
 
-    /* Redirect stderr to stdout (so that driver will get all output
-     * on the pipe connected to stdout) */
-    dup2(1, 2);
-
-    /* Parse the command line */
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
-        switch (c) {
-        case 'h':             /* print help message */
-            usage();
-	    break;
-        case 'v':             /* emit additional diagnostic info */
-            verbose = 1;
-	    break;
-        case 'p':             /* don't print a prompt */
-            emit_prompt = 0;  /* handy for automatic testing */
-	    break;
-	default:
-            usage();
+    for (i = 0; i < nseg - 1; i++) {
+	if (pipe(fd) < 0)
+	    unix_error("pipe error");
+	if ((pid = fork()) < 0)
+	    unix_error("fork error");
+	if (pid == 0) {
+	    if (in >= 0) {
+		dup2(in, 0);
+		close(in);
+	    }
+	    dup2(fd[1], 1);
+	    close(fd[1]);
+	    close(fd[0]);
+	    run_segment(segs[i], envp);
 	}
+	if (in >= 0)
+	    close(in);
+	close(fd[1]);
+	in = fd[0];
     }
+    if (in >= 0) {
+	dup2(in, 0);
+	close(in);
+    }
+    run_segment(segs[nseg-1], envp);
+}
 
-    /* Install the signal handlers */
+/*
+ * iscopier - Is name the cat or tee builtin?
+ */
+int iscopier(const char *name)
+{
+    return (strcmp(name, "cat") == 0 || strcmp(name, "tee") == 0) &&
+	getfunc(name) == NULL;
+}
 
-    /* These are the ones you will need to implement */
-    Signal(SIGINT,  sigint_handler);   /* ctrl-c */
-    Signal(SIGTSTP, sigtstp_handler);  /* ctrl-z */
-    Signal(SIGCHLD, sigchld_handler);  /* Terminated or stopped child */
+/*
+ * copypipe - Run a foreground pipeline whose first or last command
+ *    is cat or tee.  That command runs in the shell, connected by a
+ *    pipe to a job running the rest of the pipeline.
+ */
+void copypipe(char ***segs, int nseg, char *cmdline)
+{
+    int first = iscopier(segs[0][0]);
+    int fd[2], save[3], saved, status, jobstatus;
+    pid_t pid;
 
-    /* This one provides a clean way to kill the shell */
-    Signal(SIGQUIT, sigquit_handler); 
+    if (pipe2(fd, O_CLOEXEC) < 0)
+	unix_error("pipe error");
+    fcntl(fd[0], F_SETPIPE_SZ, PIPEBUF);   /* fewer, larger splices */
 
-    /* Initialize the job list */
-    initjobs(jobs);
+    /* the job gets the other end of the pipe */
+    if (first) {
+	saved = movefd(0, fd[0]);
+	pid = forkjob(segs + 1, nseg - 1, 0, cmdline, fd[1]);
+	restorefd(0, saved);
+	saved = movefd(1, fd[1]);
+    }
+    else {
+	saved = movefd(1, fd[1]);
+	pid = forkjob(segs, nseg - 1, 0, cmdline, fd[0]);
+	restorefd(1, saved);
+	saved = movefd(0, fd[0]);
+    }
+    close(fd[0]);
+    close(fd[1]);
 
-    /* Execute the shell's read/eval loop */
-    while (1) {
+    /* and the shell runs cat or tee with this one */
+    status = 1;
+    if (redirect(segs[first ? 0 : nseg-1], save) == 0) {
+	last_status = 0;
+	builtin_cmd(segs[first ? 0 : nseg-1]);
+	status = last_status;
+    }
+    unredirect(save);
+    restorefd(first ? 1 : 0, saved);   /* closes the pipe: EOF for the job */
 
-	/* Read command line */
-	if (emit_prompt) {
-	    printf("%s", prompt);
-	    fflush(stdout);
-	}
-	if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin))
-	    app_error("fgets error");
-	if (feof(stdin)) { /* End of file (ctrl-d) */
-	    fflush(stdout);
-	    exit(0);
-	}
+    /* $? is the last command's: the job's, or tee's or cat's at the end */
+    jobstatus = waitfg(pid);
+    last_status = first ? jobstatus : status;
+}
 
-	/* Evaluate the command line */
-	eval(cmdline);
-	fflush(stdout);
-	fflush(stdout);
-    } 
+/*
+ * copyfallback - Does errno say the kernel can't copy between these
+ *    two descriptors by itself?
+ */
+int copyfallback(int err)
+{
+    return err == EINVAL || err == EXDEV || err == ENOSYS ||
+	err == EOPNOTSUPP || err == EBADF;
+}
 
-    exit(0); /* control never reaches here */
+/*
+ * copybuf - The buffer of the read/write fallback, allocated on first use
+ */
+char *copybuf(void)
+{
+    static char *buf;
+
+    if (buf == NULL && (buf = malloc(COPYBUF)) == NULL)
+	unix_error("copybuf error");
+    return buf;
 }
-  
-/* 
- * eval - Evaluate the command line that the user has just typed in
- * 
- * If the user has requested a built-in command (quit, jobs, bg or fg)
- * then execute it immediately. Otherwise, fork a child process and
- * run the job in the context of the child. If the job is running in
- * the foreground, wait for it to terminate and then return.  Note:
- * each child process must have a unique process group ID so that our
- * background children don't receive SIGINT (SIGTSTP) from the kernel
- * when we type ctrl-c (ctrl-z) at the keyboard.  
-*/
-void eval(char *cmdline) 
+
+/*
+ * writeall - Write all n bytes of buf to fd.  Returns -1 on error.
+ */
+int writeall(int fd, const char *buf, size_t n)
 {
-        char *argv[MAXARGS]; // initiliaze list of arguments
-        int bg = parseline(cmdline, argv); // call parseline function
-	int built = builtin_cmd(argv);
-	sigset_t mask; // initialize variable of sigset and pid
-    	pid_t pid;
+    ssize_t w;
 
-	if(argv[0] == '/0') { // if the command line is blank return nothing
-		return;
+    while (n > 0) {
+	if ((w = write(fd, buf, n)) < 0) {
+	    if (errno == EINTR && !interrupted)
+		continue;
+	    return -1;
 	}
+	buf += w;
+	n -= w;
+    }
+    return 0;
+}
 
-        if(builtin_cmd(argv) == 1) { // if a built in command is called
-		return;
-	}
+/*
+ * rwcopy - Copy up to n bytes from in to out through copybuf.
+ *    Returns the number copied, 0 at end of file, or -1 on error.
+ */
+ssize_t rwcopy(int in, int out, size_t n)
+{
+    char *buf = copybuf();
+    ssize_t r;
 
-        if(built == 0) { // fork
-        	sigprocmask(SIG_BLOCK, &mask, NULL); // blocking child signal
-        	pid = fork(); // forking
-
-		if(pid == 0) { // if it is a child
-			setpgid(0, 0); // puts child in new process group
-            		sigprocmask(SIG_UNBLOCK, &mask, NULL); // unblocks child signal
-
-           		int file_descript1 = 0; // initialize variables for file desciptors
-            		int file_descript2 = 0;
-            		int file_descript3 = 0;
-            		int file_descript4 = 0;
-            		int file_descript5 [2];
-            		int stdoutApp = 0; // initialize variables for true/false
-            		int stderror = 0;
-            		int stdinput = 0;
-            		int stdoutput = 0;
-            		pid_t pipeID; // intialize pipe
-            		char in[64]; // initialize list for what goes in and out
-            		char out[64];
-			int i=0;
-
-			while(argv[i] != NULL) { // iterate through command line
-                		if(strcmp(argv[i], "<") == 0) { // if "<"
-                    			argv[i] = NULL; // remove from command line
-                    			strcpy(in, argv[i+1]); // copy to in
-                    			stdinput = 1; // set stdinput to 1 for if statement below
-                		}
-
-                		else if(strcmp(argv[i], ">") == 0) { // if ">"
-                    			argv[i] = NULL;
-                    			strcpy(out, argv[i+1]); // copy to out
-                    			stdoutput = 1;
-                		}
-
-                                else if(strcmp(argv[i], "2>") == 0) { // if "2>"
-                                        argv[i] = NULL;
-                                        strcpy(out, argv[i+1]);
-                                        stderror = 1;
-                                }
-
-                		else if(strcmp(argv[i], ">>") == 0) { // if ">>"
-                    			argv[i] = NULL;
-                    			strcpy(out, argv[i+1]);
-                    			stdoutApp = 1;
-                		}
-
-                		else if(strcmp(argv[i], "|") == 0) { // if pipe
-                    			fflush(stdout);
-                    			int j=0;
-                    			char** left = (char**)malloc(32); // memory for leftside of pipe
-                    			while (j < i) {
-                        			left[j] = argv[j]; // adds leftside into array
-                        			j = j + 1; // increment
-                    			}
-
-                    			int k = 0;
-                    			argv[i] = NULL; // remove "|"
-                    			char** right = (char**)malloc(32); // memory for rightside of pipe
-                    			while (argv[i+1] != NULL) { // while not empty
-                        			right[k] = argv[i+1]; // adds rightside into array
-                        			k = k + 1; // increment
-                        			i = i + 1;
-                    			}
-
-                    			pipe(file_descript5); // starts the pipe
-                    			pipeID = fork(); // creates child
-                    			if(pipeID == 0) { // if it is a child
-                        			dup2(file_descript5[0],0); // read side of pipe dup to stdin
-                        			close(file_descript5[1]); // close pipe
-                        			execve(right[0], right, environ);
-                    			}
-
-                    			else { // parent
-                        			dup2(file_descript5[1],1); // write side of pipe dup to stdout
-                        			close(file_descript5[0]); //	close read side of pipe
-                        			execve(left[0], left, environ);
-                    			}
-				}
-				i = i + 1;
-			}
+    if (n > COPYBUF)
+	n = COPYBUF;
+    while ((r = read(in, buf, n)) < 0 && errno == EINTR && !interrupted)
+	;
+    if (r > 0 && writeall(out, buf, r) < 0)
+	return -1;
+    return r;
+}
 
-            		if (stdinput == 1) { // if stdinput is true
-                		file_descript1 = open(in, O_RDWR, 0); // set to open with flag
-                		dup2(file_descript1, 0);
-                		close(file_descript1); // close file
-                		stdinput = 0; // set varible back to 0
-
-            		}
-
-                        if (stdoutApp == 1) { // if stdout is true
-                                file_descript3 = open(out, O_WRONLY | O_APPEND); //set to open with flags
-                                dup2(file_descript3, 1);
-                                close(file_descript3); // close file
-                                stdoutApp = 0; // set variable back to 0
-                        }
-
-            		if (stdoutput == 1) { // if stdoutput is true
-                		file_descript2 = creat(out, 0777); // creat() == open() with flags O_CREAT|O_WRONLY|O_TRUNC
-                		dup2(file_descript2, 1);
-                		close(file_descript2); //  close file
-                		stdoutput = 0; // set variable back to 0
-            		}
-
-            		if (stderror == 1) { // if stderror is true
-                		file_descript4 = creat(out, 0777); // creat() == open() with flags O_CREAT|O_WRONLY|O_TRUNC
-                		dup2(file_descript4, 2);
-                		close(file_descript4); // close file
-                		stderror = 0; // set varibale back to 0
-            		}
-
-			if(execve(argv[0], argv, environ) < 0) { // if execve fails
-                		printf("%s: Command not found\n", argv[0]);
-				exit(0);
-			}
-		}
+/*
+ * copyfd - Copy everything from in to out.  The kernel moves the data
+ *    (copy_file_range between files, splice to or from a pipe,
+ *    sendfile from a file to anything else); only when it refuses is
+ *    the data copied through copybuf.  Returns -1 on error.
+ */
+int copyfd(int in, int out)
+{
+    struct stat si, so;
+    int how = 0;    /* 0 read/write, 1 copy_file_range, 2 splice, 3 sendfile */
+    ssize_t n;
 
-		else { // if it is a parent
-			sigprocmask(SIG_UNBLOCK, &mask, NULL); // unblocks child signal
+    if (fstat(in, &si) < 0 || fstat(out, &so) < 0)
+	return -1;
+    if (S_ISREG(si.st_mode) && S_ISREG(so.st_mode))
+	how = 1;
+    else if (S_ISFIFO(si.st_mode) || S_ISFIFO(so.st_mode))
+	how = 2;
+    else if (S_ISREG(si.st_mode))
+	how = 3;
 
-			if(bg == 0) { // if it is a foreground job
-				addjob(jobs, pid, FG, cmdline); // adds to the FG jobs
-                		waitfg(pid); // waits to finish it
-			}
-			else { // if it is a background job
-				addjob(jobs, pid, BG, cmdline); // add to the BG jobs
-                		printf("[%d] (%d) %s", pid2jid(pid), pid, cmdline);
-			}
-		}
+    while (!interrupted) {
+	switch (how) {
+	case 1:
+	    n = copy_file_range(in, NULL, out, NULL, XFERMAX, 0);
+	    break;
+	case 2:
+	    n = splice(in, NULL, out, NULL, XFERMAX, SPLICE_F_MOVE);
+	    break;
+	case 3:
+	    n = sendfile(out, in, NULL, XFERMAX);
+	    break;
+	default:
+	    n = rwcopy(in, out, COPYBUF);
+	    break;
 	}
-return;
+	if (n == 0)
+	    return 0;
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (how != 0 && copyfallback(errno)) {
+		how = 0;
+		continue;
+	    }
+	    return -1;
+	}
+    }
+    return 0;
 }
 
 /*
- * parseline - Parse the command line and build the argv array.
- *
- * Characters enclosed in single quotes are treated as a single
- * argument.  Return true if the user has requested a BG job, false if
- * the user has requested a FG job.  
+ * do_cat - Execute the builtin cat command
  */
-int parseline(const char *cmdline, char **argv) 
+void do_cat(char **argv)
 {
-    static char array[MAXLINE]; /* holds local copy of command line */
-    char *buf = array;          /* ptr that traverses command line */
-    char *delim;                /* points to first space delimiter */
-    int argc;                   /* number of args */
-    int bg;                     /* background job? */
+    static char *stdinonly[] = { "-", NULL };
+    char **files = argv[1] ? argv + 1 : stdinonly;
+    handler_t *oldpipe = Signal(SIGPIPE, SIG_IGN);  /* EPIPE ends the copy */
+    struct stat si, so;
+    int i, fd;
 
-    strcpy(buf, cmdline);
-    buf[strlen(buf)-1] = ' ';  /* replace trailing '\n' with space */
-    while (*buf && (*buf == ' ')) /* ignore leading spaces */
-	buf++;
+    fflush(stdout);
+    if (fstat(1, &so) < 0)
+	so.st_mode = 0;
+    for (i = 0; files[i] != NULL; i++) {
+	if (strcmp(files[i], "-") == 0) {
+	    fd = 0;
+	}
+	else if ((fd = open(files[i], O_RDONLY)) < 0) {
+	    fprintf(stderr, "cat: %s: %s\n", files[i], strerror(errno));
+	    last_status = 1;
+	    continue;
+	}
 
-    /* Build the argv list */
-    argc = 0;
-    if (*buf == '\'') {
-	buf++;
-	delim = strchr(buf, '\'');
+	if (fstat(fd, &si) == 0 && S_ISREG(si.st_mode) && S_ISREG(so.st_mode) &&
+	    si.st_dev == so.st_dev && si.st_ino == so.st_ino) {
+	    fprintf(stderr, "cat: %s: input file is output file\n", files[i]);
+	    last_status = 1;
+	}
+	else if (copyfd(fd, 1) < 0) {
+	    if (errno == EPIPE) {   /* the reader is done: stop, but not failed */
+		if (fd != 0)
+		    close(fd);
+		break;
+	    }
+	    fprintf(stderr, "cat: %s: %s\n", files[i], strerror(errno));
+	    last_status = 1;
+	}
+	if (fd != 0)
+	    close(fd);
     }
-    else {
-	delim = strchr(buf, ' ');
+    Signal(SIGPIPE, oldpipe);
+}
+
+/*
+ * drainpipe - Move the n bytes waiting in the pipe p to out
+ */
+int drainpipe(int p, int out, size_t n)
+{
+    ssize_t r;
+
+    while (n > 0) {
+	r = splice(p, NULL, out, NULL, n, SPLICE_F_MOVE);
+	if (r < 0 && errno == EINTR)
+	    continue;
+	if (r < 0 && copyfallback(errno))
+	    r = rwcopy(p, out, n);
+	if (r <= 0)
+	    return -1;
+	n -= r;
+    }
+    return 0;
+}
+
+/*
+ * do_tee - Execute the builtin tee [-a] file... command.  When stdin
+ *    is a pipe, each chunk of it is duplicated with tee(2) into a
+ *    scratch pipe once for every output but the last and spliced on
+ *    from there; the last output gets the chunk itself.
+ */
+void do_tee(char **argv)
+{
+    handler_t *oldpipe = Signal(SIGPIPE, SIG_IGN);
+    int outs[MAXARGS], nouts = 0, scratch[2], havescratch, zerocopy, i, fd;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    ssize_t n = 0;
+
+    fflush(stdout);
+    i = 1;
+    if (argv[1] != NULL && strcmp(argv[1], "-a") == 0) {
+	flags = O_WRONLY | O_CREAT | O_APPEND;
+	i = 2;
+    }
+    outs[nouts++] = 1;
+    for (; argv[i] != NULL; i++) {
+	if ((fd = open(argv[i], flags, 0666)) < 0) {
+	    fprintf(stderr, "tee: %s: %s\n", argv[i], strerror(errno));
+	    last_status = 1;
+	    continue;
+	}
+	outs[nouts++] = fd;
     }
 
-    while (delim) {
-	argv[argc++] = buf;
-	*delim = '\0';
-	buf = delim + 1;
-	while (*buf && (*buf == ' ')) /* ignore spaces */
-	       buf++;
+    zerocopy = havescratch = pipe2(scratch, O_CLOEXEC) == 0;
+    if (havescratch)
+	fcntl(scratch[0], F_SETPIPE_SZ, PIPEBUF);
 
-	if (*buf == '\'') {
-	    buf++;
-	    delim = strchr(buf, '\'');
+    while (!interrupted) {
+	if (zerocopy) {
+	    n = tee(0, scratch[1], XFERMAX, 0);
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    if (n < 0 && copyfallback(errno)) {
+		zerocopy = 0;     /* stdin is not a pipe */
+		continue;
+	    }
+	    if (n <= 0)
+		break;
+	    /* scratch is empty before each tee, so each one takes n bytes */
+	    for (i = 0; i < nouts - 1; i++)
+		if ((i > 0 && tee(0, scratch[1], n, 0) != n) ||
+		    drainpipe(scratch[0], outs[i], n) < 0)
+		    goto error;
+	    if (drainpipe(0, outs[nouts-1], n) < 0)
+		goto error;
 	}
 	else {
-	    delim = strchr(buf, ' ');
+	    char *buf = copybuf();
+
+	    if ((n = read(0, buf, COPYBUF)) < 0 && errno == EINTR)
+		continue;
+	    if (n <= 0)
+		break;
+	    for (i = 0; i < nouts; i++)
+		if (writeall(outs[i], buf, n) < 0)
+		    goto error;
+	}
+    }
+    if (n < 0) {
+ error:
+	if (errno != EPIPE) {   /* a reader closing early is not a failure */
+	    fprintf(stderr, "tee: %s\n", strerror(errno));
+	    last_status = 1;
 	}
     }
-    argv[argc] = NULL;
-    
-    if (argc == 0)  /* ignore blank line */
-	return 1;
 
-    /* should the job run in the background? */
-    if ((bg = (*argv[argc-1] == '&')) != 0) {
-	argv[--argc] = NULL;
+    if (havescratch) {
+	close(scratch[0]);
+	close(scratch[1]);
     }
-    return bg;
+    for (i = 1; i < nouts; i++)
+	close(outs[i]);
+    Signal(SIGPIPE, oldpipe);
 }
 
 /* 
@@ -402,6 +3915,40 @@ int builtin_cmd(char **argv)
                 return 1;
                 }
 
+        if(strcmp(argv[0], "wait") == 0) { // if the built in command is wait
+                do_wait(argv);
+                return 1;
+                }
+
+        if(strcmp(argv[0], "export") == 0) { // if the built in command is export
+                do_export(argv);
+                return 1;
+                }
+
+        if(strcmp(argv[0], "unset") == 0) { // if the built in command is unset
+                do_unset(argv);
+                return 1;
+                }
+
+        if(strcmp(argv[0], "cat") == 0) { // if the built in command is cat
+                do_cat(argv);
+                return 1;
+                }
+
+        if(strcmp(argv[0], "tee") == 0) { // if the built in command is tee
+                do_tee(argv);
+                return 1;
+                }
+
+        if(strcmp(argv[0], "local") == 0) { // if the built in command is local
+                do_local(argv);
+                return 1;
+                }
+
+        if(do_script(argv)) { // echo, test, break and the other scripting builtins
+                return 1;
+                }
+
     return 0; // if it is not a builtin command
 }
 
@@ -465,14 +4012,136 @@ void do_bgfg(char **argv)
 }
 
 /* 
- * waitfg - Block until process pid is no longer the foreground process
+ * waitfg - Block until process pid is no longer the foreground process,
+ *    and set $? to the status the reaper recorded for it.  Returns
+ *    that status.
  */
-void waitfg(pid_t pid)
+int waitfg(pid_t pid)
 {
+	sigset_t mask, prev;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &prev); // so the SIGCHLD can't slip in before sigsuspend
         while(fgpid(jobs) == pid) { // wait until process ID not in fg
-                sleep(1); // sleep while in fg
+                sigsuspend(&prev); // sleep until the reaper has run
         }
-        return;
+	if(fgreaped == pid) // read with SIGCHLD still blocked
+		last_status = fgreapedstatus;
+	sigprocmask(SIG_SETMASK, &prev, NULL);
+        return last_status;
+}
+
+/*
+ * finddone - Look up a finished job by pid, or by jid if pid is 0
+ */
+struct done_t *finddone(pid_t pid, int jid)
+{
+	unsigned i;
+
+	for(i = ndone; i > 0 && ndone - i < MAXDONE; i--) { // newest first
+		struct done_t *d = &done[(i - 1) % MAXDONE];
+		if(pid ? d->pid == pid : d->jid == jid)
+			return d;
+	}
+	return NULL;
+}
+
+/*
+ * anyrunning - Is some background job still running?
+ */
+int anyrunning(void)
+{
+	int i;
+
+	for(i = 0; i < MAXJOBS; i++)
+		if(jobs[i].state == BG)
+			return 1;
+	return 0;
+}
+
+/*
+ * waitpid1 - Wait for the background job pid (or %jid if pid is 0)
+ *     and return its status.  SIGCHLD must be blocked; prev is the
+ *     mask to sleep with.
+ */
+int waitpid1(pid_t pid, int jid, char *arg, sigset_t *prev)
+{
+	struct job_t *job = pid ? getjobpid(jobs, pid) : getjobjid(jobs, jid);
+	struct done_t *d;
+
+	if(job != NULL) {
+		pid = job->pid;
+		while(job->pid == pid && job->state == BG && !interrupted) // the handler clears it when done
+			sigsuspend(prev);
+		if(job->pid == pid && job->state == ST) // stopped, it may never finish
+			return 128 + SIGTSTP;
+	}
+	if(interrupted)
+		return 130;
+	if((d = finddone(pid, jid)) == NULL) {
+		printf("wait: %s: no such job\n", arg);
+		return 127;
+	}
+	d->reported = 1;
+	return d->status;
+}
+
+/*
+ * do_wait - Execute the builtin wait command: wait for every
+ *     background job, for the given ones (%jid or pid), or with -n for
+ *     whichever finishes next.  The status is that of the last job
+ *     waited for.
+ */
+void do_wait(char **argv)
+{
+	sigset_t mask, prev;
+	int i, status = 0;
+	unsigned j;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &prev); // the handler can't change jobs or done under us
+
+	if(argv[1] != NULL && strcmp(argv[1], "-n") == 0) { // any one job
+		status = 127; // no jobs to wait for
+		while(!interrupted) {
+			for(j = ndone > MAXDONE ? ndone - MAXDONE : 0; j < ndone; j++) // oldest first
+				if(!done[j % MAXDONE].reported)
+					break;
+			if(j < ndone) {
+				done[j % MAXDONE].reported = 1;
+				status = done[j % MAXDONE].status;
+				break;
+			}
+			if(!anyrunning())
+				break;
+			sigsuspend(&prev); // woken by the reaper
+		}
+	}
+	else if(argv[1] == NULL) { // all of them
+		while(anyrunning() && !interrupted)
+			sigsuspend(&prev);
+		for(j = 0; j < MAXDONE; j++)
+			done[j].reported = 1;
+	}
+	else {
+		for(i = 1; argv[i] != NULL; i++) {
+			if(argv[i][0] == '%' && isdigit((unsigned char)argv[i][1]))
+				status = waitpid1(0, atoi(&argv[i][1]), argv[i], &prev);
+			else if(isdigit((unsigned char)argv[i][0]))
+				status = waitpid1(atoi(argv[i]), 0, argv[i], &prev);
+			else {
+				printf("wait: %s: not a pid or job id\n", argv[i]);
+				status = 2;
+			}
+		}
+	}
+	if(interrupted)
+		status = 130;
+
+	sigprocmask(SIG_SETMASK, &prev, NULL);
+	last_status = status;
 }
 
 /*****************
@@ -490,13 +4159,31 @@ void sigchld_handler(int sig)
 {
 	pid_t pid;
 	int status;
+	int code; // exit status as in $?
 	struct job_t *job;
 
-	while((pid = waitpid(fgpid(jobs), &status, WNOHANG | WUNTRACED)) > 0) { // reaping zombie children
+	while((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) { // reaping zombie children, background ones too
 		job = getjobpid(jobs, pid); // gets job ID
 
 		if (job != NULL) { // if not NULL
-			struct job_t* job = getjobpid(jobs,pid);
+			if(WIFEXITED(status)) // the status as $? shows it
+				code = WEXITSTATUS(status);
+			else if(WIFSIGNALED(status))
+				code = 128 + WTERMSIG(status);
+			else
+				code = 128 + WSTOPSIG(status);
+
+			if(job->state == FG) { // for waitfg, which sets $? from it
+				fgreaped = pid;
+				fgreapedstatus = code;
+			}
+			else if(!WIFSTOPPED(status)) { // kept for wait after deletejob
+				struct done_t *d = &done[ndone++ % MAXDONE];
+				d->pid = pid;
+				d->jid = job->jid;
+				d->status = code;
+				d->reported = 0;
+			}
 
 			if(WIFSIGNALED(status)) { // if terminate signal is received
 				printf("Job [%d] (%d) terminated by signal %d\n",pid2jid(pid),pid,WTERMSIG(status));
@@ -525,6 +4212,7 @@ void sigint_handler(int sig)
 {
 	pid_t pid = fgpid(jobs); // sends SIGINT to every process in group
 
+	interrupted = 1; // stops a running loop as well
 	if(pid != 0) { // if pid is not zero
 		kill(-pid,sig); // terminate process
     	}
@@ -715,7 +4403,7 @@ void listjobs(struct job_t *jobs)
  */
 void usage(void) 
 {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvp] [script [arg ...]]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
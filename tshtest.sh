@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# tshtest.sh - checks of tsh's expansions against known output
+#
+# Each case feeds a few lines to tsh -p in a scratch directory and
+# compares what it prints with what a POSIX shell prints.  Build tsh
+# first:
+#
+#     gcc -O2 -o tsh tsh.c
+#     sh tshtest.sh [path to tsh]
+#
+# Prints the cases that fail and exits nonzero if any did.
+
+TSH=$(cd "$(dirname "${1:-./tsh}")" && pwd)/$(basename "${1:-./tsh}")
+SCRATCH=$(mktemp -d) || exit 1
+trap 'rm -rf "$SCRATCH"' EXIT
+failed=0
+
+#
+# check - run the tsh input $2 in $SCRATCH and compare its output with $3
+#
+check()
+{
+    got=$(cd "$SCRATCH" && printf '%s\n' "$2" | "$TSH" -p 2>&1)
+    if [ "$got" != "$3" ]; then
+	printf 'FAIL %s\n  expected: %s\n  got:      %s\n' "$1" "$3" "$got"
+	failed=1
+    fi
+}
+
+# A pattern ending in / matches only directories, and keeps the /.
+mkdir "$SCRATCH/sub" "$SCRATCH/sub2" "$SCRATCH/sub/inner"
+touch "$SCRATCH/file" "$SCRATCH/sub/f"
+ln -s sub "$SCRATCH/lnk"
+check "glob */" 'echo */' 'lnk/ sub/ sub2/'
+check "glob *" 'echo *' 'file lnk sub sub2'
+check "glob s*/" 'echo s*/' 'sub/ sub2/'
+check "glob */*/" 'echo */*/' 'lnk/inner/ sub/inner/'
+check "glob f*/" 'echo f*/' 'f*/'
+check "glob sub/*/" 'echo sub/*/' 'sub/inner/'
+
+[ $failed = 0 ] && echo ok
+exit $failed